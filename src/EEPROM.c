@@ -12,22 +12,122 @@
 #define FLASH_KEY1 ((uint32_t)0x45670123)
 #define FLASH_KEY2 ((uint32_t)0xCDEF89AB)
 
-// EEPROM identifiers
-#define EEPROM_MARKER 0x5A5A
-
-// Memory map:
-// EEPROM_ADDRESS + 0: Marker (16-bit)
-// EEPROM_ADDRESS + 2: Reserved (16-bit)
-// EEPROM_ADDRESS + 4: Variable storage (triplets of 16-bit: ID, Value, CRC)
-
-// Initialize EEPROM
+// Log bounds of a shard page (see EEPROM_layout.h for the memory map)
+#define EEPROM_DATA_START(base) ((base) + EEPROM_HEADER_SIZE)
+#define EEPROM_DATA_END(base) ((base) + EEPROM_PAGE_SIZE)
+
+// Page of the shard holding a variable
+#define EEPROM_BASE_OF(id) EEPROM_SHARD_ADDRESS(EEPROM_SHARD_OF(id))
+
+// Outcome of a page scan for a variable
+#define EEPROM_SCAN_NONE 0     // No record of the variable
+#define EEPROM_SCAN_FOUND 1    // Newest record holds a value
+#define EEPROM_SCAN_DELETED 2  // Newest record is a tombstone
+
+#if ((EEPROM_MAX_VARS * EEPROM_HISTORY_KEEP + 1) * EEPROM_RECORD_SIZE + \
+     EEPROM_HEADER_SIZE) > EEPROM_PAGE_SIZE
+#error "EEPROM_MAX_VARS * EEPROM_HISTORY_KEEP + 1 records do not fit in a page"
+#endif
+
+#if EEPROM_SHARDS < 1
+#error "EEPROM_SHARDS must be at least 1"
+#endif
+
+#if EEPROM_BATCH_MAX < 1 || EEPROM_BATCH_MAX > 255
+#error "EEPROM_BATCH_MAX must be between 1 and 255"
+#endif
+
+#if EEPROM_COLD_PAGE && EEPROM_COLD_EXTERNAL
+#error "Choose either EEPROM_COLD_PAGE or EEPROM_COLD_EXTERNAL"
+#endif
+
+#if EEPROM_LOG_PAGES == 1
+#error "EEPROM_LOG_PAGES needs a second page to erase ahead"
+#endif
+
+#if EEPROM_CRASH_PAGE && EEPROM_CRASH_BLOCKS != 1 && \
+    EEPROM_CRASH_BLOCKS != 2 && EEPROM_CRASH_BLOCKS != 4 && \
+    EEPROM_CRASH_BLOCKS != 8
+#error "EEPROM_CRASH_BLOCKS must be 1, 2, 4 or 8"
+#endif
+
+// Flash operation statistics
+static EEPROM_Stats EEPROM_stats = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// In dry-run mode erases and programs are counted but not performed
+static uint8_t EEPROM_dryRun = 0;
+
+// Saves deferred by EEPROM_saveVarWithin or held for coalescing, newest
+// value per ID. Held saves are due at a time in ms, deferred ones at 0.
+static uint16_t EEPROM_deferredIds[EEPROM_DEFER_DEPTH];
+static uint16_t EEPROM_deferredValues[EEPROM_DEFER_DEPTH];
+static uint32_t EEPROM_deferredDue[EEPROM_DEFER_DEPTH];
+static uint8_t EEPROM_deferredCount = 0;
+
+// Key directories, one bit per key bucket (EEPROM_KEY_BUCKET): keys with a
+// record or tombstone in the shards and keys in the cold tier. They are
+// built page by page, a page on the first lookup of a key it holds, and
+// EEPROM_dirPages tells which pages are in (a bit per shard, then one for
+// the cold tier). Bits are only set until the next rebuild, so a clear bit
+// proves that no key of the bucket is stored in the pages that are in.
+static uint8_t EEPROM_hotDir[32];
+#if EEPROM_COLD_TIER
+static uint8_t EEPROM_coldDir[32];
+#endif
+static uint8_t EEPROM_dirValid = 0;
+static uint32_t EEPROM_dirPages = 0;
+
+// Current generation of the store (see EEPROM_KEY_CLEAR), read from shard 0
+// on first use
+static uint16_t EEPROM_generation = 0;
+static uint8_t EEPROM_genValid = 0;
+static uint16_t EEPROM_resets = 0;
+
+#if EEPROM_COLD_EXTERNAL
+static EEPROM_ExtDevice* EEPROM_coldDevice = NULL;
+#endif
+
+#if EEPROM_WRITE_COMBINE
+// Write combining: the half-words of appended records that fall into the
+// erased block EEPROM_combineBlock are staged in a RAM image of it, and
+// the block is programmed in one operation once it is full, too old or
+// flushed. Half-words before the block (where a run of saves starts in the
+// middle of one) are programmed right away. Lookups check the image; other
+// code that reads a shard flushes it first.
+static uint32_t EEPROM_combineImage[EEPROM_LOG_BLOCK / 4];
+static uint32_t EEPROM_combineBlock = 0;  // 0 when nothing is staged
+static uint32_t EEPROM_combineEnd = 0;    // End of the last staged record
+#if EEPROM_COMBINE_MS
+static uint32_t EEPROM_combineDue = 0;
+#endif
+#endif
+
+#if EEPROM_ISR_CACHE
+// ISR cache, a seqlock latch: readers use copy (seq & 1) of the values
+// while the main loop writes the other copy, so a reader never waits for
+// the writer and only retries when the writer ran in the middle of its read
+static volatile uint16_t EEPROM_cacheKeys[EEPROM_ISR_CACHE];
+static volatile uint16_t EEPROM_cacheValues[2][EEPROM_ISR_CACHE];
+static volatile uint8_t EEPROM_cacheCount = 0;
+static volatile uint32_t EEPROM_cacheSeq = 0;
+#endif
+
+// Directory pages: the shards, then the cold tier
+#define EEPROM_DIR_PAGES (EEPROM_SHARDS + EEPROM_COLD_TIER)
+
+#if !EEPROM_LAZY_MOUNT
+static void EEPROM_buildDir(void);
+#endif
+
+// Initialize EEPROM: forget what was read from flash and, unless mounting
+// lazily, index the whole store now
 void EEPROM_init(void) {
-    // Nothing to initialize
-}
+    EEPROM_dirValid = 0;
+    EEPROM_genValid = 0;
 
-// Simple CRC calculation
-static uint16_t EEPROM_calcCRC(uint16_t id, uint16_t value) {
-    return (uint16_t)(id ^ value);
+#if !EEPROM_LAZY_MOUNT
+    EEPROM_buildDir();
+#endif
 }
 
 // Wait for flash operations to complete
@@ -43,19 +143,26 @@ static uint8_t EEPROM_waitForLastOperation(void) {
 
 // Unlock flash for writing
 static void EEPROM_unlockFlash(void) {
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_UNLOCK, 0);
+
     if (FLASH->CTLR & FLASH_CTLR_LOCK) {
         FLASH->KEYR = FLASH_KEY1;
         FLASH->KEYR = FLASH_KEY2;
     }
+
+    EEPROM_TRACE_END(EEPROM_TRACE_UNLOCK, 0);
 }
 
 // Lock flash after writing
 static void EEPROM_lockFlash(void) { FLASH->CTLR |= FLASH_CTLR_LOCK; }
 
 // Erase a page of flash
-uint8_t EEPROM_format(void) {
+static uint8_t EEPROM_erasePage(uint32_t base) {
     uint8_t status;
 
+    EEPROM_stats.erases++;
+    if (EEPROM_dryRun) return EEPROM_OK;
+
     EEPROM_unlockFlash();
 
     // Wait for any ongoing operations
@@ -65,10 +172,12 @@ uint8_t EEPROM_format(void) {
         return status;
     }
 
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_ERASE, base);
+
     // Set page erase bit
     FLASH->CTLR |= FLASH_CTLR_PER;
     // Set the address to erase
-    FLASH->ADDR = EEPROM_ADDRESS;
+    FLASH->ADDR = base;
     // Start the erase operation
     FLASH->CTLR |= FLASH_CTLR_STRT;
 
@@ -78,8 +187,14 @@ uint8_t EEPROM_format(void) {
     // Clear page erase bit
     FLASH->CTLR &= ~FLASH_CTLR_PER;
 
+    EEPROM_TRACE_END(EEPROM_TRACE_ERASE, base);
+
     // Check if erase worked
-    if (*(volatile uint16_t*)EEPROM_ADDRESS != 0xFFFF) {
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_VERIFY, base);
+    uint8_t erased = (*(volatile uint16_t*)base == 0xFFFF);
+    EEPROM_TRACE_END(EEPROM_TRACE_VERIFY, base);
+
+    if (!erased) {
         EEPROM_lockFlash();
         return EEPROM_ERROR;
     }
@@ -92,6 +207,9 @@ uint8_t EEPROM_format(void) {
 static uint8_t EEPROM_writeHalfWord(uint32_t address, uint16_t data) {
     uint8_t status;
 
+    EEPROM_stats.programs++;
+    if (EEPROM_dryRun) return EEPROM_OK;
+
     EEPROM_unlockFlash();
 
     // Wait for any ongoing operations
@@ -101,6 +219,8 @@ static uint8_t EEPROM_writeHalfWord(uint32_t address, uint16_t data) {
         return status;
     }
 
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_PROGRAM, address);
+
     // Enable programming
     FLASH->CTLR |= FLASH_CTLR_PG;
 
@@ -113,8 +233,14 @@ static uint8_t EEPROM_writeHalfWord(uint32_t address, uint16_t data) {
     // Disable programming
     FLASH->CTLR &= ~FLASH_CTLR_PG;
 
+    EEPROM_TRACE_END(EEPROM_TRACE_PROGRAM, address);
+
     // Verify the write
-    if (*(volatile uint16_t*)address != data) {
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_VERIFY, address);
+    uint8_t written = (*(volatile uint16_t*)address == data);
+    EEPROM_TRACE_END(EEPROM_TRACE_VERIFY, address);
+
+    if (!written) {
         EEPROM_lockFlash();
         return EEPROM_ERROR;
     }
@@ -123,247 +249,2431 @@ static uint8_t EEPROM_writeHalfWord(uint32_t address, uint16_t data) {
     return status;
 }
 
-// Check if EEPROM is initialized
-static uint8_t EEPROM_isInitialized(void) {
-    return (*(volatile uint16_t*)EEPROM_ADDRESS == EEPROM_MARKER);
-}
+#if EEPROM_LOG_PAGES || EEPROM_WRITE_COMBINE
+// Write an erased block of EEPROM_LOG_BLOCK bytes with fast page
+// programming: the words are loaded into the page buffer one by one and
+// programmed in a single operation
+static uint8_t EEPROM_programBlock(uint32_t address, const uint32_t* data) {
+    volatile uint32_t* block = (volatile uint32_t*)address;
+    uint8_t status;
 
-// Find a variable by ID
-static uint8_t EEPROM_findVar(uint8_t id, uint32_t* addr) {
-    if (!EEPROM_isInitialized()) {
-        return 0;
+    if (EEPROM_dryRun) return EEPROM_OK;
+
+    EEPROM_unlockFlash();
+    FLASH->MODEKEYR = FLASH_KEY1;
+    FLASH->MODEKEYR = FLASH_KEY2;
+
+    // Wait for any ongoing operations
+    status = EEPROM_waitForLastOperation();
+    if (status != EEPROM_OK) {
+        EEPROM_lockFlash();
+        return status;
     }
 
-    uint32_t currentAddr =
-        EEPROM_ADDRESS + 4;  // Start after marker and reserved
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_PAGE_PROGRAM, address);
 
-    for (uint8_t i = 0; i < 10; i++) {  // Max 10 variables
-        uint16_t entryId = *(volatile uint16_t*)currentAddr;
+    // Clear the page buffer. The control bits of a page program are written
+    // as a whole, so a buffer command never repeats the previous one.
+    FLASH->CTLR = FLASH_CTLR_PAGE_PG;
+    FLASH->CTLR = FLASH_CTLR_PAGE_PG | FLASH_CTLR_BUF_RST;
+    FLASH->ADDR = address;
+    status = EEPROM_waitForLastOperation();
 
-        // Check for end of data (empty slot)
-        if (entryId == 0xFFFF) break;
+    // Load the data
+    for (uint8_t i = 0; i < EEPROM_LOG_BLOCK / 4 && status == EEPROM_OK;
+         i++) {
+        block[i] = data[i];
+        FLASH->CTLR = FLASH_CTLR_PAGE_PG | FLASH_CTLR_BUF_LOAD;
+        status = EEPROM_waitForLastOperation();
+    }
 
-        uint16_t entryValue = *(volatile uint16_t*)(currentAddr + 2);
-        uint16_t entryCRC = *(volatile uint16_t*)(currentAddr + 4);
+    // Program the block
+    if (status == EEPROM_OK) {
+        FLASH->CTLR = FLASH_CTLR_PAGE_PG | FLASH_CTLR_STRT;
+        status = EEPROM_waitForLastOperation();
+    }
 
-        // Check if this is our variable and CRC matches
-        if ((entryId & 0xFF) == id &&
-            entryCRC == EEPROM_calcCRC(entryId, entryValue)) {
-            if (addr) *addr = currentAddr;
-            return 1;
-        }
+    // Disable page programming
+    FLASH->CTLR &= ~FLASH_CTLR_PAGE_PG;
 
-        currentAddr += 6;  // Move to next entry (ID + Value + CRC)
+    EEPROM_TRACE_END(EEPROM_TRACE_PAGE_PROGRAM, address);
+
+    // Verify the write
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_VERIFY, address);
+    for (uint8_t i = 0; i < EEPROM_LOG_BLOCK / 4; i++) {
+        if (block[i] != data[i]) status = EEPROM_ERROR;
     }
+    EEPROM_TRACE_END(EEPROM_TRACE_VERIFY, address);
 
-    return 0;  // Not found
+    FLASH->CTLR |= FLASH_CTLR_FLOCK;
+    EEPROM_lockFlash();
+    return status;
 }
+#endif
+
+#if EEPROM_ISR_CACHE
+// Publish new values of cached keys, all of them at once: ids NULL stands
+// for every cached key and values NULL for absent ones
+static void EEPROM_cachePublish(const uint16_t* ids, const uint16_t* values,
+                                uint8_t count) {
+    if (EEPROM_dryRun) return;
+
+    for (uint8_t copy = 0; copy < 2; copy++) {
+        // Move the readers to the other copy, then update this one
+        EEPROM_cacheSeq++;
+        uint8_t write = (uint8_t)((EEPROM_cacheSeq & 1) ^ 1);
+
+        for (uint8_t i = 0; i < EEPROM_cacheCount; i++) {
+            if (!ids) {
+                EEPROM_cacheValues[write][i] = 0xFFFF;
+                continue;
+            }
 
+            for (uint8_t j = 0; j < count; j++) {
+                if (ids[j] == EEPROM_cacheKeys[i]) {
+                    EEPROM_cacheValues[write][i] = values ? values[j] : 0xFFFF;
+                }
+            }
+        }
+    }
+}
+#endif
 
+// Erase the pages of all shards and the cold tier
+uint8_t EEPROM_format(void) {
+    EEPROM_dirValid = 0;
+    EEPROM_genValid = 0;
 
-// Save a variable
-uint8_t EEPROM_saveVar(uint8_t id, uint16_t value) {
-    uint8_t status;
-    uint8_t varIds[10];  // Store up to 10 variables
-    uint16_t varValues[10];
-    uint8_t varCount = 0;
+    // Held saves belong to the store being erased
+    if (!EEPROM_dryRun) {
+        EEPROM_deferredCount = 0;
+        EEPROM_resets++;
+    }
+#if EEPROM_WRITE_COMBINE
+    if (!EEPROM_dryRun) {
+        EEPROM_combineBlock = 0;
+        EEPROM_stats.unpersisted = 0;
+    }
+#endif
+#if EEPROM_ISR_CACHE
+    EEPROM_cachePublish(NULL, NULL, 0);
+#endif
 
-    // If not initialized, erase and initialize
-    if (!EEPROM_isInitialized()) {
-        status = EEPROM_format();
+    for (uint8_t page = 0; page < EEPROM_PAGES; page++) {
+        uint8_t status = EEPROM_erasePage(EEPROM_SHARD_ADDRESS(page));
         if (status != EEPROM_OK) return status;
+    }
 
-        // Write marker
-        status = EEPROM_writeHalfWord(EEPROM_ADDRESS, EEPROM_MARKER);
-        if (status != EEPROM_OK) return status;
+#if EEPROM_COLD_EXTERNAL
+    if (EEPROM_coldDevice && !EEPROM_dryRun) {
+        return EEPROM_extFormat(EEPROM_coldDevice);
+    }
+#endif
 
-        // Write reserved (just zeros)
-        status = EEPROM_writeHalfWord(EEPROM_ADDRESS + 2, 0);
-        if (status != EEPROM_OK) return status;
-    } else {
-        // Read all existing variables
-        uint32_t currentAddr =
-            EEPROM_ADDRESS + 4;  // Start after marker and reserved
+    return EEPROM_OK;
+}
 
-        for (uint8_t i = 0; i < 10; i++) {  // Max 10 variables
-            uint16_t entryId = *(volatile uint16_t*)currentAddr;
+// Check the CRC of the record at the given address
+static uint8_t EEPROM_recordValid(uint32_t addr) {
+    uint16_t entryId = *(volatile uint16_t*)addr;
+    uint16_t entryValue = *(volatile uint16_t*)(addr + 2);
+    uint16_t entryCRC = *(volatile uint16_t*)(addr + 4);
 
-            // Check for end of data (empty slot)
-            if (entryId == 0xFFFF) break;
+    return (entryCRC == EEPROM_calcCRC(entryId, entryValue));
+}
 
-            uint16_t entryValue = *(volatile uint16_t*)(currentAddr + 2);
-            uint16_t entryCRC = *(volatile uint16_t*)(currentAddr + 4);
+// Check if the record at the given address is a generation record
+static uint8_t EEPROM_isGeneration(uint32_t addr) {
+    return (*(volatile uint16_t*)addr == EEPROM_KEY_CLEAR &&
+            EEPROM_recordValid(addr));
+}
 
-            // Skip the one we're updating
-            if ((entryId & 0xFF) == id) {
-                currentAddr += 6;  // Move to next entry
-                continue;
+// Find the first free record slot (end of the log)
+static uint32_t EEPROM_findEnd(uint32_t base);
+
+// Get the current generation: the newest generation record in shard 0
+static uint16_t EEPROM_currentGen(void) {
+    uint32_t base = EEPROM_SHARD_ADDRESS(0);
+
+    if (EEPROM_genValid) return EEPROM_generation;
+
+    EEPROM_generation = 0;
+    if (*(volatile uint16_t*)base == EEPROM_MARKER) {
+        uint32_t endAddr = EEPROM_findEnd(base);
+
+        for (uint32_t addr = EEPROM_DATA_START(base); addr < endAddr;
+             addr += EEPROM_RECORD_SIZE) {
+            if (EEPROM_isGeneration(addr)) {
+                EEPROM_generation = *(volatile uint16_t*)(addr + 2);
             }
+        }
+    }
+
+    EEPROM_genValid = 1;
+    return EEPROM_generation;
+}
+
+// Check if a page is initialized. A page of an earlier generation counts
+// as blank; pages other than shard 0 carry their generation in their first
+// record.
+static uint8_t EEPROM_isInitialized(uint32_t base) {
+    if (*(volatile uint16_t*)base != EEPROM_MARKER) return 0;
+    if (base == EEPROM_SHARD_ADDRESS(0)) return 1;
+
+    uint32_t first = EEPROM_DATA_START(base);
+    uint16_t gen = 0;
+
+    if (EEPROM_isGeneration(first)) gen = *(volatile uint16_t*)(first + 2);
+    return gen == EEPROM_currentGen();
+}
+
+// Check if the record at the given address is a tombstone
+static uint8_t EEPROM_isTombstone(uint32_t addr) {
+    uint16_t entryId = *(volatile uint16_t*)addr;
+
+    return (*(volatile uint16_t*)(addr + 2) == EEPROM_TOMBSTONE_VALUE &&
+            *(volatile uint16_t*)(addr + 4) == EEPROM_tombstoneCRC(entryId));
+}
+
+// Check if a record slot is fully erased
+static uint8_t EEPROM_slotErased(uint32_t addr) {
+    return (*(volatile uint16_t*)addr == 0xFFFF &&
+            *(volatile uint16_t*)(addr + 2) == 0xFFFF &&
+            *(volatile uint16_t*)(addr + 4) == 0xFFFF);
+}
+
+// Records are written strictly in order, so the slots with an ID come
+// first and the end is found by binary search. A torn write (e.g. a block
+// program cut short) can leave programmed half-words after an erased slot,
+// so the end is only accepted once the EEPROM_END_CHECK slots after it are
+// erased; otherwise the check walks on and the end moves past them, and
+// the next record goes to erased flash.
+static uint32_t EEPROM_findEnd(uint32_t base) {
+    uint32_t start = EEPROM_DATA_START(base);
+    uint16_t low = 0;
+    uint16_t high = EEPROM_SLOTS;
+
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_SCAN, base);
+
+    while (low < high) {
+        uint16_t mid = (uint16_t)((low + high) / 2);
+
+        if (*(volatile uint16_t*)(start + mid * EEPROM_RECORD_SIZE) !=
+            0xFFFF) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    uint16_t end = low;
+
+    for (uint16_t slot = low;
+         slot < EEPROM_SLOTS && slot < end + EEPROM_END_CHECK; slot++) {
+        if (!EEPROM_slotErased(start + slot * EEPROM_RECORD_SIZE)) {
+            end = slot + 1;
+        }
+    }
+
+    EEPROM_TRACE_END(EEPROM_TRACE_SCAN, base);
+    return start + (uint32_t)end * EEPROM_RECORD_SIZE;
+}
+
+// Check the page summary for a variable
+static uint8_t EEPROM_mayContain(uint32_t base, uint16_t id) {
+    uint16_t summary = *(volatile uint16_t*)(base + 2);
+
+    return (summary == EEPROM_SUMMARY_NONE ||
+            (summary & EEPROM_SUMMARY_BIT(id)) != 0);
+}
+
+// Find the newest record of a variable in one page
+static uint8_t EEPROM_scanPage(uint32_t base, uint16_t id, uint32_t* addr) {
+    uint8_t found = EEPROM_SCAN_NONE;
+
+    if (!EEPROM_isInitialized(base) || !EEPROM_mayContain(base, id)) {
+        return EEPROM_SCAN_NONE;
+    }
+    EEPROM_stats.pagesScanned++;
+
+    uint32_t currentAddr = EEPROM_DATA_START(base);
+    uint32_t endAddr = EEPROM_findEnd(base);
+
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_SCAN, base);
 
-            // Check CRC
-            if (entryCRC == EEPROM_calcCRC(entryId, entryValue)) {
-                varIds[varCount] = entryId & 0xFF;
-                varValues[varCount] = entryValue;
-                varCount++;
+    // Records are appended, so the last valid match is the newest one
+    while (currentAddr < endAddr) {
+        uint16_t entryId = *(volatile uint16_t*)currentAddr;
+
+        // Earlier generations end at a generation record
+        if (EEPROM_isGeneration(currentAddr)) found = EEPROM_SCAN_NONE;
+
+        // Check if this is our variable and CRC matches
+        if (entryId == id) {
+            if (EEPROM_recordValid(currentAddr)) {
+                if (addr) *addr = currentAddr;
+                found = EEPROM_SCAN_FOUND;
+            } else if (EEPROM_isTombstone(currentAddr)) {
+                found = EEPROM_SCAN_DELETED;
             }
+        }
+
+        currentAddr += EEPROM_RECORD_SIZE;
+    }
+
+    EEPROM_TRACE_END(EEPROM_TRACE_SCAN, base);
+    return found;
+}
+
+#if EEPROM_COLD_TIER
+// Find the newest value of a variable in the cold tier
+static uint8_t EEPROM_findCold(uint16_t id, uint16_t* value) {
+#if EEPROM_COLD_EXTERNAL
+    uint16_t newest;
+
+    if (!EEPROM_coldDevice) return 0;
+    EEPROM_stats.pagesScanned++;
+
+    if (!EEPROM_extReadHistory(EEPROM_coldDevice, id, &newest, 1)) return 0;
+    if (value) *value = newest;
+    return 1;
+#else
+    uint32_t addr;
+
+    if (EEPROM_scanPage(EEPROM_COLD_ADDRESS, id, &addr) != EEPROM_SCAN_FOUND) {
+        return 0;
+    }
+    if (value) *value = *(volatile uint16_t*)(addr + 2);
+    return 1;
+#endif
+}
+
+#endif
+
+// Mark the bucket of a key in a directory
+static void EEPROM_dirMark(uint8_t* dir, uint16_t id) {
+    uint8_t bucket = EEPROM_KEY_BUCKET(id);
+
+    dir[bucket >> 3] |= (uint8_t)(1 << (bucket & 7));
+}
+
+// Check if the bucket of a key is marked in a directory
+static uint8_t EEPROM_dirHas(const uint8_t* dir, uint16_t id) {
+    uint8_t bucket = EEPROM_KEY_BUCKET(id);
+
+    return (dir[bucket >> 3] >> (bucket & 7)) & 1;
+}
 
-            currentAddr += 6;  // Move to next entry
+// Mark every key with a record or tombstone in a page
+static void EEPROM_dirAddPage(uint8_t* dir, uint32_t base) {
+    if (!EEPROM_isInitialized(base)) return;
+
+    uint32_t endAddr = EEPROM_findEnd(base);
+
+    for (uint32_t addr = EEPROM_DATA_START(base); addr < endAddr;
+         addr += EEPROM_RECORD_SIZE) {
+        if (EEPROM_recordValid(addr) || EEPROM_isTombstone(addr)) {
+            EEPROM_dirMark(dir, *(volatile uint16_t*)addr);
         }
     }
+}
 
-    // Add our new variable
-    varIds[varCount] = id;
-    varValues[varCount] = value;
-    varCount++;
+// Add a page of the directories (EEPROM_DIR_PAGES) unless it is in already
+static void EEPROM_dirLoad(uint8_t page) {
+    if (!EEPROM_dirValid) {
+        for (uint8_t i = 0; i < sizeof(EEPROM_hotDir); i++) {
+            EEPROM_hotDir[i] = 0;
+        }
+#if EEPROM_COLD_TIER
+        for (uint8_t i = 0; i < sizeof(EEPROM_coldDir); i++) {
+            EEPROM_coldDir[i] = 0;
+        }
+#endif
+        EEPROM_dirPages = 0;
+        EEPROM_dirValid = 1;
+    }
 
-    // Now write all variables to a new page
-    status = EEPROM_format();
-    if (status != EEPROM_OK) return status;
+    if (EEPROM_dirPages & ((uint32_t)1 << page)) return;
+    EEPROM_dirPages |= (uint32_t)1 << page;
 
-    // Write marker
-    status = EEPROM_writeHalfWord(EEPROM_ADDRESS, EEPROM_MARKER);
+    if (page < EEPROM_SHARDS) {
+        EEPROM_dirAddPage(EEPROM_hotDir, EEPROM_SHARD_ADDRESS(page));
+        return;
+    }
+
+#if EEPROM_COLD_EXTERNAL
+    if (EEPROM_coldDevice) {
+        EEPROM_extKeyBitmap(EEPROM_coldDevice, EEPROM_coldDir);
+    }
+#elif EEPROM_COLD_PAGE
+    EEPROM_dirAddPage(EEPROM_coldDir, EEPROM_COLD_ADDRESS);
+#endif
+}
+
+#if !EEPROM_LAZY_MOUNT
+// Rebuild the key directories from the stored records
+static void EEPROM_buildDir(void) {
+    EEPROM_dirValid = 0;
+
+    for (uint8_t page = 0; page < EEPROM_DIR_PAGES; page++) {
+        EEPROM_dirLoad(page);
+    }
+}
+#endif
+
+// Add the next page that is not in the directories yet
+uint8_t EEPROM_mountStep(void) {
+    uint32_t all = ((uint32_t)1 << EEPROM_DIR_PAGES) - 1;
+    uint8_t page = 0;
+
+    if (EEPROM_dirValid) {
+        if (EEPROM_dirPages == all) return 0;
+        while (EEPROM_dirPages & ((uint32_t)1 << page)) page++;
+    }
+
+    EEPROM_dirLoad(page);
+    return EEPROM_dirPages != all;
+}
+
+// Find the newest value of a variable by ID
+static uint8_t EEPROM_findVar(uint16_t id, uint16_t* value) {
+    uint32_t addr = 0;
+
+    EEPROM_stats.lookups++;
+    EEPROM_dirLoad(EEPROM_SHARD_OF(id));
+
+    // Shard records, tombstones included, are always newer than cold ones
+    if (EEPROM_dirHas(EEPROM_hotDir, id)) {
+        uint8_t found = EEPROM_scanPage(EEPROM_BASE_OF(id), id, &addr);
+
+        if (found == EEPROM_SCAN_FOUND) {
+            if (value) *value = *(volatile uint16_t*)(addr + 2);
+            return 1;
+        }
+        if (found == EEPROM_SCAN_DELETED) return 0;
+    }
+
+#if EEPROM_COLD_TIER
+    EEPROM_dirLoad(EEPROM_SHARDS);
+    if (EEPROM_dirHas(EEPROM_coldDir, id)) {
+        return EEPROM_findCold(id, value);
+    }
+#endif
+
+    return 0;
+}
+
+// Append a record to the log
+static uint8_t EEPROM_writeEntry(uint32_t addr, uint16_t id, uint16_t value,
+                                uint16_t crc) {
+    uint8_t status;
+
+    // Write ID
+    status = EEPROM_writeHalfWord(addr, id);
     if (status != EEPROM_OK) return status;
 
-    // Write reserved (just zeros)
-    status = EEPROM_writeHalfWord(EEPROM_ADDRESS + 2, 0);
+    // Write value
+    status = EEPROM_writeHalfWord(addr + 2, value);
     if (status != EEPROM_OK) return status;
 
-    // Write each variable
-    uint32_t currentAddr = EEPROM_ADDRESS + 4;
+    // Write CRC last so a torn record never validates
+    return EEPROM_writeHalfWord(addr + 4, crc);
+}
 
-    for (uint8_t i = 0; i < varCount; i++) {
-        uint16_t varId = varIds[i];
-        uint16_t varValue = varValues[i];
-        uint16_t varCRC = EEPROM_calcCRC(varId, varValue);
+static uint8_t EEPROM_writeRecord(uint32_t addr, uint16_t id, uint16_t value) {
+    return EEPROM_writeEntry(addr, id, value, EEPROM_calcCRC(id, value));
+}
 
-        // Write ID
-        status = EEPROM_writeHalfWord(currentAddr, varId);
-        if (status != EEPROM_OK) return status;
+static uint8_t EEPROM_writeTombstone(uint32_t addr, uint16_t id) {
+    return EEPROM_writeEntry(addr, id, EEPROM_TOMBSTONE_VALUE,
+                             EEPROM_tombstoneCRC(id));
+}
 
-        // Write value
-        status = EEPROM_writeHalfWord(currentAddr + 2, varValue);
-        if (status != EEPROM_OK) return status;
+#if EEPROM_COALESCE_MS || (EEPROM_WRITE_COMBINE && EEPROM_COMBINE_MS)
+// Millisecond clock kept from the tick counter, which may wrap at any value
+static uint32_t EEPROM_clockMs = 0;
+static uint32_t EEPROM_clockTicks = 0;
 
-        // Write CRC
-        status = EEPROM_writeHalfWord(currentAddr + 4, varCRC);
-        if (status != EEPROM_OK) return status;
+static uint32_t EEPROM_nowMs(void) {
+    uint32_t ticks = EEPROM_TICKS();
+    uint32_t elapsed = ticks - EEPROM_clockTicks;
+
+    EEPROM_clockMs += elapsed / EEPROM_TICKS_PER_MS;
+    EEPROM_clockTicks = ticks - elapsed % EEPROM_TICKS_PER_MS;
+    return EEPROM_clockMs;
+}
+
+#endif
+
+#if EEPROM_WRITE_COMBINE
+// Read a half-word of the log, staged or programmed
+static uint16_t EEPROM_combineRead(uint32_t addr) {
+    if (!EEPROM_combineBlock || addr < EEPROM_combineBlock) {
+        return *(volatile uint16_t*)addr;
+    }
+
+    uint32_t offset = addr - EEPROM_combineBlock;
+    return (uint16_t)(EEPROM_combineImage[offset / 4] >> ((offset & 2) * 8));
+}
+
+// Program the staged block
+static uint8_t EEPROM_combineFlush(void) {
+    uint32_t block = EEPROM_combineBlock;
+
+    if (!block || EEPROM_dryRun) return EEPROM_OK;
+
+    // The directories may have been rebuilt from flash since these were
+    // staged
+    for (uint32_t addr = EEPROM_combineEnd - EEPROM_RECORD_SIZE;
+         addr + 4 >= block; addr -= EEPROM_RECORD_SIZE) {
+        EEPROM_dirMark(EEPROM_hotDir, EEPROM_combineRead(addr));
+    }
+
+    EEPROM_combineBlock = 0;
+    EEPROM_stats.blocks++;
+    EEPROM_stats.unpersisted = 0;
+    return EEPROM_programBlock(block, EEPROM_combineImage);
+}
 
-        currentAddr += 6;  // Move to next entry
+// Start staging the erased block at the given address
+static void EEPROM_combineOpen(uint32_t block) {
+    for (uint8_t i = 0; i < EEPROM_LOG_BLOCK / 4; i++) {
+        EEPROM_combineImage[i] = 0xFFFFFFFF;
     }
+    EEPROM_combineBlock = block;
+#if EEPROM_COMBINE_MS
+    EEPROM_combineDue = EEPROM_nowMs() + EEPROM_COMBINE_MS;
+#endif
+}
 
+// Program the staged block once it is EEPROM_COMBINE_MS old
+static uint8_t EEPROM_combineExpire(void) {
+#if EEPROM_COMBINE_MS
+    if (EEPROM_combineBlock &&
+        (int32_t)(EEPROM_nowMs() - EEPROM_combineDue) >= 0) {
+        return EEPROM_combineFlush();
+    }
+#endif
     return EEPROM_OK;
 }
 
-// Save multiple variables at once
-uint8_t EEPROM_saveVars(uint8_t *ids, uint16_t *values, uint8_t count) {
+// End of the log of a shard, staged records included
+static uint32_t EEPROM_combineFindEnd(uint32_t base) {
+    if (EEPROM_combineBlock &&
+        (EEPROM_combineBlock & ~(uint32_t)(EEPROM_PAGE_SIZE - 1)) == base) {
+        return EEPROM_combineEnd;
+    }
+
+    return EEPROM_findEnd(base);
+}
+
+// Append a record, staging what falls into an erased block. The CRC is
+// still the last half-word to reach flash.
+static uint8_t EEPROM_combineRecord(uint32_t addr, uint16_t id,
+                                    uint16_t value) {
+    uint16_t half[3] = {id, value, EEPROM_calcCRC(id, value)};
     uint8_t status;
-    uint8_t varIds[10];      // Store up to 10 variables
-    uint16_t varValues[10];
-    uint8_t varCount = 0;
 
-    // If not initialized, erase and initialize
-    if (!EEPROM_isInitialized()) {
-        status = EEPROM_format();
-        if (status != EEPROM_OK) return status;
+    if (EEPROM_dryRun) return EEPROM_writeRecord(addr, id, value);
 
-        // Write marker
-        status = EEPROM_writeHalfWord(EEPROM_ADDRESS, EEPROM_MARKER);
-        if (status != EEPROM_OK) return status;
+    if (EEPROM_combineBlock) {
+        uint32_t page = EEPROM_combineBlock & ~(uint32_t)(EEPROM_PAGE_SIZE - 1);
 
-        // Write reserved (just zeros)
-        status = EEPROM_writeHalfWord(EEPROM_ADDRESS + 2, 0);
-        if (status != EEPROM_OK) return status;
-    } else {
-        // Read all existing variables
-        uint32_t currentAddr = EEPROM_ADDRESS + 4;  // Start after marker
+        // The staged block of another shard is kept until it fills up
+        if ((addr & ~(uint32_t)(EEPROM_PAGE_SIZE - 1)) != page) {
+            return EEPROM_writeRecord(addr, id, value);
+        }
 
-        for (uint8_t i = 0; i < 10; i++) {
-            uint16_t entryId = *(volatile uint16_t*)currentAddr;
+        // Staging continues only right after the staged records
+        if (addr != EEPROM_combineEnd) {
+            status = EEPROM_combineFlush();
+            if (status != EEPROM_OK) return status;
+        }
+    }
 
-            // Check for end of data (empty slot)
-            if (entryId == 0xFFFF) break;
+    if (!EEPROM_combineBlock) {
+        uint32_t block = (addr + EEPROM_LOG_BLOCK - 1) &
+                         ~(uint32_t)(EEPROM_LOG_BLOCK - 1);
 
-            uint16_t entryValue = *(volatile uint16_t*)(currentAddr + 2);
-            uint16_t entryCRC   = *(volatile uint16_t*)(currentAddr + 4);
-
-            // Check CRC
-            if (entryCRC == EEPROM_calcCRC(entryId, entryValue)) {
-                uint8_t baseId = entryId & 0xFF;
-                // Skip if this ID will be updated by our new list
-                uint8_t skip = 0;
-                for (uint8_t j = 0; j < count; j++) {
-                    if (ids[j] == baseId) {
-                        skip = 1;
-                        break;
-                    }
-                }
-                if (!skip) {
-                    varIds[varCount] = baseId;
-                    varValues[varCount] = entryValue;
-                    varCount++;
-                }
-            }
-            currentAddr += 6;  // Next entry
+        // Nothing of the record reaches the next block
+        if (addr + EEPROM_RECORD_SIZE <= block) {
+            return EEPROM_writeRecord(addr, id, value);
         }
+        EEPROM_combineOpen(block);
     }
 
-    // Append all new variables (overwriting any previous ones)
-    for (uint8_t j = 0; j < count; j++) {
-        if (varCount >= 10) break; // prevent overflow
-        varIds[varCount] = ids[j];
-        varValues[varCount] = values[j];
-        varCount++;
+    for (uint8_t k = 0; k < 3; k++) {
+        uint32_t a = addr + 2 * k;
+
+        if (a < EEPROM_combineBlock) {
+            status = EEPROM_writeHalfWord(a, half[k]);
+            if (status != EEPROM_OK) return status;
+            continue;
+        }
+
+        // The record runs on into the next block
+        if (a >= EEPROM_combineBlock + EEPROM_LOG_BLOCK) {
+            uint32_t next = EEPROM_combineBlock + EEPROM_LOG_BLOCK;
+
+            status = EEPROM_combineFlush();
+            if (status != EEPROM_OK) return status;
+            EEPROM_combineOpen(next);
+        }
+
+        uint32_t offset = a - EEPROM_combineBlock;
+        uint8_t shift = (uint8_t)((offset & 2) * 8);
+
+        EEPROM_combineImage[offset / 4] &= ~((uint32_t)0xFFFF << shift);
+        EEPROM_combineImage[offset / 4] |= (uint32_t)half[k] << shift;
     }
 
-    // Erase page and rewrite everything
-    status = EEPROM_format();
-    if (status != EEPROM_OK) return status;
+    EEPROM_combineEnd = addr + EEPROM_RECORD_SIZE;
 
-    // Write marker
-    status = EEPROM_writeHalfWord(EEPROM_ADDRESS, EEPROM_MARKER);
-    if (status != EEPROM_OK) return status;
+    // The CRC went to the image, so the record is not in flash yet
+    if (EEPROM_combineBlock && EEPROM_combineEnd > EEPROM_combineBlock) {
+        EEPROM_stats.unpersisted++;
+        if (EEPROM_stats.unpersisted > EEPROM_stats.unpersistedMax) {
+            EEPROM_stats.unpersistedMax = EEPROM_stats.unpersisted;
+        }
+    }
 
-    // Write reserved
-    status = EEPROM_writeHalfWord(EEPROM_ADDRESS + 2, 0);
-    if (status != EEPROM_OK) return status;
+    // A full block goes out right away
+    if (EEPROM_combineEnd == EEPROM_combineBlock + EEPROM_LOG_BLOCK) {
+        return EEPROM_combineFlush();
+    }
 
-    // Write each variable
-    uint32_t currentAddr = EEPROM_ADDRESS + 4;
+    return EEPROM_OK;
+}
 
-    for (uint8_t i = 0; i < varCount; i++) {
-        uint16_t varId    = varIds[i];
-        uint16_t varValue = varValues[i];
-        uint16_t varCRC   = EEPROM_calcCRC(varId, varValue);
+// Find the newest staged record of a variable
+static uint8_t EEPROM_combineFind(uint16_t id, uint16_t* value) {
+    if (!EEPROM_combineBlock) return 0;
 
-        // Write ID
-        status = EEPROM_writeHalfWord(currentAddr, varId);
-        if (status != EEPROM_OK) return status;
+    // Staged records are those whose CRC is in the image
+    for (uint32_t addr = EEPROM_combineEnd - EEPROM_RECORD_SIZE;
+         addr + 4 >= EEPROM_combineBlock; addr -= EEPROM_RECORD_SIZE) {
+        if (EEPROM_combineRead(addr) == id) {
+            if (value) *value = EEPROM_combineRead(addr + 2);
+            return 1;
+        }
+    }
 
-        // Write value
-        status = EEPROM_writeHalfWord(currentAddr + 2, varValue);
-        if (status != EEPROM_OK) return status;
+    return 0;
+}
 
-        // Write CRC
-        status = EEPROM_writeHalfWord(currentAddr + 4, varCRC);
-        if (status != EEPROM_OK) return status;
+// Program the staged records now
+uint8_t EEPROM_flushCombined(void) { return EEPROM_combineFlush(); }
+
+// Program the staged records once they are EEPROM_COMBINE_MS old
+uint8_t EEPROM_serviceCombined(void) { return EEPROM_combineExpire(); }
+#endif
+
+// Retained versions of one variable, oldest first. A count of 0 stands
+// for a deleted variable.
+typedef struct {
+    uint16_t id;
+    uint8_t count;
+    uint16_t values[EEPROM_HISTORY_KEEP];
+} EEPROM_VarHistory;
+
+// Find the entry of a variable in vars, kept sorted by ID, inserting an
+// empty one when it is not there yet
+static uint8_t EEPROM_varSlot(EEPROM_VarHistory* vars, uint8_t* varCount,
+                              uint8_t maxVars, uint16_t id, uint8_t* index) {
+    uint8_t low = 0;
+    uint8_t high = *varCount;
+
+    while (low < high) {
+        uint8_t mid = (uint8_t)((low + high) / 2);
+
+        if (vars[mid].id < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == *varCount || vars[low].id != id) {
+        if (*varCount >= maxVars) return EEPROM_ERROR;
 
-        currentAddr += 6;
+        for (uint8_t i = *varCount; i > low; i--) vars[i] = vars[i - 1];
+        vars[low].id = id;
+        vars[low].count = 0;
+        (*varCount)++;
     }
 
+    *index = low;
     return EEPROM_OK;
 }
 
+// Push a value into the retained versions of its variable
+static uint8_t EEPROM_keepValue(EEPROM_VarHistory* vars, uint8_t* varCount,
+                                uint8_t maxVars, uint16_t id, uint16_t value) {
+    uint8_t i;
 
-// Read a variable by ID
-uint16_t EEPROM_readVar(uint8_t id) {
-    uint32_t addr;
+    if (EEPROM_varSlot(vars, varCount, maxVars, id, &i) != EEPROM_OK) {
+        return EEPROM_ERROR;
+    }
 
-    if (EEPROM_findVar(id, &addr)) {
-        return *(volatile uint16_t*)(addr + 2);
+    // Drop the oldest version once K versions are held
+    if (vars[i].count == EEPROM_HISTORY_KEEP) {
+        for (uint8_t k = 1; k < EEPROM_HISTORY_KEEP; k++) {
+            vars[i].values[k - 1] = vars[i].values[k];
+        }
+        vars[i].count--;
     }
 
-    return 0xFFFF;  // Not found/invalid
+    vars[i].values[vars[i].count++] = value;
+    return EEPROM_OK;
 }
 
-// Check if variable exists
-uint8_t EEPROM_varExists(uint8_t id) { return EEPROM_findVar(id, NULL); }
+// Forget the retained versions of a deleted variable
+static uint8_t EEPROM_dropValues(EEPROM_VarHistory* vars, uint8_t* varCount,
+                                 uint8_t maxVars, uint16_t id) {
+    uint8_t i;
+
+    if (EEPROM_varSlot(vars, varCount, maxVars, id, &i) != EEPROM_OK) {
+        return EEPROM_ERROR;
+    }
+
+    vars[i].count = 0;
+    return EEPROM_OK;
+}
+
+// Read the newest versions of every variable in a page, oldest first
+static uint8_t EEPROM_collect(uint32_t base, EEPROM_VarHistory* vars,
+                              uint8_t* varCount, uint8_t maxVars) {
+    if (!EEPROM_isInitialized(base)) {
+        return EEPROM_OK;
+    }
+
+    uint8_t status = EEPROM_OK;
+    uint32_t currentAddr = EEPROM_DATA_START(base);
+    uint32_t endAddr = EEPROM_findEnd(base);
+
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_SCAN, base);
+
+    while (currentAddr < endAddr) {
+        if (EEPROM_isGeneration(currentAddr)) {
+            // Everything before it belongs to an earlier generation
+            *varCount = 0;
+        } else if (EEPROM_recordValid(currentAddr)) {
+            uint16_t entryId = *(volatile uint16_t*)currentAddr;
+            uint16_t entryValue = *(volatile uint16_t*)(currentAddr + 2);
+
+            status = EEPROM_keepValue(vars, varCount, maxVars, entryId,
+                                      entryValue);
+            if (status != EEPROM_OK) break;
+        } else if (EEPROM_isTombstone(currentAddr)) {
+            uint16_t entryId = *(volatile uint16_t*)currentAddr;
+
+            status = EEPROM_dropValues(vars, varCount, maxVars, entryId);
+            if (status != EEPROM_OK) break;
+        }
+        currentAddr += EEPROM_RECORD_SIZE;
+    }
+
+    EEPROM_TRACE_END(EEPROM_TRACE_SCAN, base);
+    return status;
+}
+
+// Erase a page and write its header, followed by the generation record
+// unless the generation is 0
+static uint8_t EEPROM_startPage(uint32_t base, uint16_t summary,
+                                uint16_t gen) {
+    uint8_t status;
+
+    status = EEPROM_erasePage(base);
+    if (status != EEPROM_OK) return status;
+
+    // Write marker
+    status = EEPROM_writeHalfWord(base, EEPROM_MARKER);
+    if (status != EEPROM_OK) return status;
+
+    // Write summary
+    status = EEPROM_writeHalfWord(base + 2, summary);
+    if (status != EEPROM_OK) return status;
+
+    if (gen == 0) return EEPROM_OK;
+    return EEPROM_writeRecord(EEPROM_DATA_START(base), EEPROM_KEY_CLEAR, gen);
+}
+
+// Erase a page and write the given variables back, oldest version first,
+// and a tombstone for deleted ones. With summarize set, the header gets the
+// summary of the written IDs.
+static uint8_t EEPROM_rewrite(uint32_t base, EEPROM_VarHistory* vars,
+                              uint8_t varCount, uint8_t summarize,
+                              uint16_t* written) {
+    uint8_t status;
+    uint16_t summary = EEPROM_SUMMARY_NONE;
+    uint16_t gen = EEPROM_currentGen();
+
+    *written = 0;
+
+    if (summarize) {
+        for (uint8_t i = 0; i < varCount; i++) {
+            summary |= EEPROM_SUMMARY_BIT(vars[i].id);
+        }
+    }
+
+    // Erase page and rewrite everything
+    status = EEPROM_startPage(base, summary, gen);
+    if (status != EEPROM_OK) return status;
+
+    // Write each variable
+    uint32_t currentAddr = EEPROM_DATA_START(base);
+    if (gen != 0) currentAddr += EEPROM_RECORD_SIZE;
+
+    for (uint8_t i = 0; i < varCount; i++) {
+        if (vars[i].count == 0) {
+            status = EEPROM_writeTombstone(currentAddr, vars[i].id);
+            if (status != EEPROM_OK) return status;
+
+            currentAddr += EEPROM_RECORD_SIZE;
+            (*written)++;
+        }
+
+        for (uint8_t k = 0; k < vars[i].count; k++) {
+            status = EEPROM_writeRecord(currentAddr, vars[i].id,
+                                        vars[i].values[k]);
+            if (status != EEPROM_OK) return status;
+
+            currentAddr += EEPROM_RECORD_SIZE;
+            (*written)++;
+        }
+    }
+
+    return EEPROM_OK;
+}
+
+// Drop deleted variables before a shard is rewritten. A tombstone is only
+// kept while older values of its variable remain in the cold tier.
+static void EEPROM_pruneDeleted(EEPROM_VarHistory* vars, uint8_t* varCount) {
+    uint8_t kept = 0;
+
+    for (uint8_t i = 0; i < *varCount; i++) {
+        if (vars[i].count == 0) {
+#if EEPROM_COLD_TIER
+            if (!EEPROM_findCold(vars[i].id, NULL)) continue;
+#else
+            continue;
+#endif
+        }
+        vars[kept++] = vars[i];
+    }
+
+    *varCount = kept;
+}
+
+#if EEPROM_COLD_TIER
+// Saves of each variable since its shard was last compacted
+typedef struct {
+    uint16_t id;
+    uint8_t saves;
+} EEPROM_VarActivity;
+
+static EEPROM_VarActivity EEPROM_activity[EEPROM_CAPACITY];
+static uint8_t EEPROM_activityCount = 0;
+
+// Count a save of a variable
+static void EEPROM_noteSave(uint16_t id) {
+    uint8_t i;
+
+    for (i = 0; i < EEPROM_activityCount; i++) {
+        if (EEPROM_activity[i].id == id) break;
+    }
+
+    if (i == EEPROM_activityCount) {
+        // Untracked variables simply count as cold
+        if (EEPROM_activityCount >= EEPROM_CAPACITY) return;
+        EEPROM_activity[i].id = id;
+        EEPROM_activity[i].saves = 0;
+        EEPROM_activityCount++;
+    }
+
+    if (EEPROM_activity[i].saves < 0xFF) EEPROM_activity[i].saves++;
+}
+
+// Check if a variable was saved rarely since its shard was last compacted
+static uint8_t EEPROM_isCold(uint16_t id) {
+    for (uint8_t i = 0; i < EEPROM_activityCount; i++) {
+        if (EEPROM_activity[i].id == id) {
+            return EEPROM_activity[i].saves < EEPROM_COLD_THRESHOLD;
+        }
+    }
+
+    return 1;
+}
+
+// Start counting again for the variables of a compacted shard
+static void EEPROM_resetActivity(uint8_t shard) {
+    for (uint8_t i = 0; i < EEPROM_activityCount; i++) {
+        if (EEPROM_SHARD_OF(EEPROM_activity[i].id) == shard) {
+            EEPROM_activity[i].saves = 0;
+        }
+    }
+}
+
+#if EEPROM_COLD_EXTERNAL
+// Append variables to the external cold tier
+static uint8_t EEPROM_saveCold(EEPROM_VarHistory* vars, uint8_t varCount) {
+    uint16_t ids[EEPROM_MAX_VARS * EEPROM_HISTORY_KEEP];
+    uint16_t values[EEPROM_MAX_VARS * EEPROM_HISTORY_KEEP];
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < varCount; i++) {
+        for (uint8_t k = 0; k < vars[i].count; k++) {
+            ids[count] = vars[i].id;
+            values[count] = vars[i].values[k];
+            count++;
+        }
+    }
+    if (count == 0) return EEPROM_OK;
+    if (!EEPROM_coldDevice) return EEPROM_ERROR;
+
+    EEPROM_stats.recordsCopied += count;
+
+    // Only internal flash operations are modeled in dry-run mode
+    if (EEPROM_dryRun) return EEPROM_OK;
+
+    return EEPROM_extSaveVars(EEPROM_coldDevice, ids, values, count);
+}
+#else
+// Append variables to the cold page, compacting it when full
+static uint8_t EEPROM_saveCold(EEPROM_VarHistory* vars, uint8_t varCount) {
+    uint8_t status;
+    uint32_t base = EEPROM_COLD_ADDRESS;
+    uint16_t records = 0;
+    uint8_t covered = 1;
+
+    for (uint8_t i = 0; i < varCount; i++) {
+        records += vars[i].count;
+        if (!EEPROM_mayContain(base, vars[i].id)) covered = 0;
+    }
+    if (records == 0) return EEPROM_OK;
+
+    // Appending an ID missing from the summary would hide it from lookups,
+    // so that takes a compaction that writes a new summary
+    if (EEPROM_isInitialized(base) && covered) {
+        uint32_t currentAddr = EEPROM_findEnd(base);
+
+        if (currentAddr + (uint32_t)records * EEPROM_RECORD_SIZE <=
+            EEPROM_DATA_END(base)) {
+            for (uint8_t i = 0; i < varCount; i++) {
+                for (uint8_t k = 0; k < vars[i].count; k++) {
+                    status = EEPROM_writeRecord(currentAddr, vars[i].id,
+                                                vars[i].values[k]);
+                    if (status != EEPROM_OK) return status;
+
+                    currentAddr += EEPROM_RECORD_SIZE;
+                }
+            }
+            EEPROM_stats.recordsCopied += records;
+            return EEPROM_OK;
+        }
+    }
+
+    // Cold page is full or not initialized yet
+    EEPROM_VarHistory cold[EEPROM_CAPACITY];
+    uint8_t coldCount = 0;
+    uint16_t written;
+
+    status = EEPROM_collect(base, cold, &coldCount, EEPROM_CAPACITY);
+    if (status != EEPROM_OK) return status;
+
+    for (uint8_t i = 0; i < varCount; i++) {
+        for (uint8_t k = 0; k < vars[i].count; k++) {
+            status = EEPROM_keepValue(cold, &coldCount, EEPROM_CAPACITY,
+                                      vars[i].id, vars[i].values[k]);
+            if (status != EEPROM_OK) return status;
+        }
+    }
+
+    status = EEPROM_rewrite(base, cold, coldCount, 1, &written);
+    EEPROM_stats.recordsCopied += written;
+    return status;
+}
+#endif
+
+// Move the cold variables of a shard to the cold tier and drop them from
+// the shard, so later compactions of the shard no longer copy them
+static uint8_t EEPROM_evictCold(EEPROM_VarHistory* vars, uint8_t* varCount) {
+    EEPROM_VarHistory cold[EEPROM_MAX_VARS];
+    uint8_t coldCount = 0;
+    uint8_t hotCount = 0;
+
+    // Tombstones stay in the shard to hide the cold values
+    for (uint8_t i = 0; i < *varCount; i++) {
+        if (vars[i].count > 0 && EEPROM_isCold(vars[i].id)) {
+            cold[coldCount++] = vars[i];
+        } else {
+            vars[hotCount++] = vars[i];
+        }
+    }
+
+    // The shard is erased only after the cold tier holds the values
+    if (!EEPROM_dryRun) {
+        for (uint8_t i = 0; i < coldCount; i++) {
+            EEPROM_dirMark(EEPROM_coldDir, cold[i].id);
+        }
+    }
+
+    uint8_t status = EEPROM_saveCold(cold, coldCount);
+    if (status != EEPROM_OK) return status;
+
+    *varCount = hotCount;
+    return EEPROM_OK;
+}
+#endif
+
+// Compact the log of one shard: keep the newest versions of every variable,
+// apply the new values (all of this shard) on top, then erase the page and
+// rewrite it. Other shards are not touched.
+static uint8_t EEPROM_compact(uint8_t shard, uint16_t* ids, uint16_t* values,
+                              uint8_t count) {
+    uint8_t status;
+    uint32_t base = EEPROM_SHARD_ADDRESS(shard);
+    EEPROM_VarHistory vars[EEPROM_MAX_VARS];
+    uint8_t varCount = 0;
+    uint16_t written;
+
+#if EEPROM_WRITE_COMBINE
+    status = EEPROM_combineFlush();
+    if (status != EEPROM_OK) return status;
+#endif
+
+    // Read all existing records, oldest first
+    status = EEPROM_collect(base, vars, &varCount, EEPROM_MAX_VARS);
+    if (status != EEPROM_OK) return status;
+
+    // Deleted and cold variables make room before the new values are added
+    EEPROM_pruneDeleted(vars, &varCount);
+
+#if EEPROM_COLD_TIER
+    status = EEPROM_evictCold(vars, &varCount);
+    if (status != EEPROM_OK) return status;
+
+    EEPROM_resetActivity(shard);
+#endif
+
+    // Add our new values
+    for (uint8_t j = 0; j < count; j++) {
+        status = EEPROM_keepValue(vars, &varCount, EEPROM_MAX_VARS, ids[j],
+                                  values[j]);
+        if (status != EEPROM_OK) return status;
+    }
+
+    status = EEPROM_rewrite(base, vars, varCount, 0, &written);
+
+    // Evicted and pruned keys leave stale directory bits behind
+    if (!EEPROM_dryRun) EEPROM_dirValid = 0;
+
+    // Everything written besides the new values was copied
+    if (written > count) {
+        EEPROM_stats.recordsCopied += written - count;
+    }
+
+    return status;
+}
+
+// Check if a shard holds a record or tombstone of a variable in the
+// current generation. Saved variables are usually near the end of the log,
+// so it is searched newest record first.
+static uint8_t EEPROM_onShard(uint32_t base, uint32_t endAddr, uint16_t id) {
+#if EEPROM_WRITE_COMBINE
+    if (EEPROM_combineFind(id, NULL)) return 1;
+#endif
+
+    for (uint32_t addr = endAddr; addr > EEPROM_DATA_START(base);) {
+        addr -= EEPROM_RECORD_SIZE;
+
+        if (EEPROM_isGeneration(addr)) return 0;
+        if (*(volatile uint16_t*)addr == id &&
+            (EEPROM_recordValid(addr) || EEPROM_isTombstone(addr))) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Check if a key is new to a shard: neither its log nor the cold page
+// holds it
+static uint8_t EEPROM_hasNewKey(uint32_t base, uint32_t endAddr,
+                                const uint16_t* ids, uint8_t count) {
+    for (uint8_t j = 0; j < count; j++) {
+        if (EEPROM_onShard(base, endAddr, ids[j])) continue;
+#if EEPROM_COLD_PAGE
+        if (EEPROM_scanPage(EEPROM_COLD_ADDRESS, ids[j], NULL) !=
+            EEPROM_SCAN_NONE) {
+            continue;
+        }
+#endif
+        return 1;
+    }
+
+    return 0;
+}
+
+// Count the variables a shard would hold with the keys added: those in its
+// log, deleted ones included unless pruned (compaction drops them), and
+// with a cold page the cold ones, which the cold page has to keep. More
+// than EEPROM_MAX_VARS when they do not even fit in the count.
+static uint8_t EEPROM_shardVars(uint8_t shard, uint8_t pruned,
+                                const uint16_t* ids, uint8_t count) {
+    EEPROM_VarHistory vars[EEPROM_MAX_VARS];
+    uint8_t varCount = 0;
+    uint8_t index;
+
+    if (EEPROM_collect(EEPROM_SHARD_ADDRESS(shard), vars, &varCount,
+                       EEPROM_MAX_VARS) != EEPROM_OK) {
+        return EEPROM_MAX_VARS + 1;
+    }
+    if (pruned) EEPROM_pruneDeleted(vars, &varCount);
+
+#if EEPROM_WRITE_COMBINE
+    // Staged records are saves newer than everything in flash, counted
+    // from the RAM image rather than programmed first
+    if (EEPROM_combineBlock &&
+        (EEPROM_combineBlock & ~(uint32_t)(EEPROM_PAGE_SIZE - 1)) ==
+            EEPROM_SHARD_ADDRESS(shard)) {
+        for (uint32_t addr = EEPROM_combineEnd - EEPROM_RECORD_SIZE;
+             addr + 4 >= EEPROM_combineBlock; addr -= EEPROM_RECORD_SIZE) {
+            if (EEPROM_varSlot(vars, &varCount, EEPROM_MAX_VARS,
+                               EEPROM_combineRead(addr),
+                               &index) != EEPROM_OK) {
+                return EEPROM_MAX_VARS + 1;
+            }
+        }
+    }
+#endif
+
+#if EEPROM_COLD_PAGE
+    EEPROM_VarHistory cold[EEPROM_CAPACITY];
+    uint8_t coldCount = 0;
+
+    if (EEPROM_collect(EEPROM_COLD_ADDRESS, cold, &coldCount,
+                       EEPROM_CAPACITY) != EEPROM_OK) {
+        return EEPROM_MAX_VARS + 1;
+    }
+
+    for (uint8_t i = 0; i < coldCount; i++) {
+        if (EEPROM_SHARD_OF(cold[i].id) == shard &&
+            EEPROM_varSlot(vars, &varCount, EEPROM_MAX_VARS, cold[i].id,
+                           &index) != EEPROM_OK) {
+            return EEPROM_MAX_VARS + 1;
+        }
+    }
+#endif
+
+    for (uint8_t j = 0; j < count; j++) {
+        if (EEPROM_varSlot(vars, &varCount, EEPROM_MAX_VARS, ids[j],
+                           &index) != EEPROM_OK) {
+            return EEPROM_MAX_VARS + 1;
+        }
+    }
+
+    return varCount;
+}
+
+// Save the part of a batch that belongs to one shard
+static uint8_t EEPROM_saveShard(uint8_t shard, uint16_t* ids, uint16_t* values,
+                                uint8_t count) {
+    uint8_t status;
+    uint32_t base = EEPROM_SHARD_ADDRESS(shard);
+
+    if (EEPROM_isInitialized(base)) {
+#if EEPROM_WRITE_COMBINE
+        uint32_t currentAddr = EEPROM_combineFindEnd(base);
+#else
+        uint32_t currentAddr = EEPROM_findEnd(base);
+#endif
+
+        // Append when the whole batch fits, older records stay as history.
+        // New variables must still fit when the shard is compacted, which
+        // only drops deleted ones then.
+        if (currentAddr + (uint32_t)count * EEPROM_RECORD_SIZE <=
+                EEPROM_DATA_END(base) &&
+            (!EEPROM_hasNewKey(base, currentAddr, ids, count) ||
+             EEPROM_shardVars(shard, 0, ids, count) <= EEPROM_MAX_VARS)) {
+            for (uint8_t j = 0; j < count; j++) {
+#if EEPROM_WRITE_COMBINE
+                status = EEPROM_combineRecord(currentAddr, ids[j], values[j]);
+#else
+                status = EEPROM_writeRecord(currentAddr, ids[j], values[j]);
+#endif
+                if (status != EEPROM_OK) return status;
+
+                currentAddr += EEPROM_RECORD_SIZE;
+            }
+            return EEPROM_OK;
+        }
+    }
+
+    // Compaction fails before erasing when the variables do not fit in the
+    // shard; the cold page has to keep the cold ones as well
+#if EEPROM_COLD_PAGE
+    if (EEPROM_shardVars(shard, 1, ids, count) > EEPROM_MAX_VARS) {
+        return EEPROM_ERROR;
+    }
+#endif
+
+    // Page is full, not initialized yet or needs the room of deleted
+    // variables
+    return EEPROM_compact(shard, ids, values, count);
+}
+
+// Find a deferred save of a variable
+static uint8_t EEPROM_findDeferred(uint16_t id, uint8_t* index) {
+    for (uint8_t i = 0; i < EEPROM_deferredCount; i++) {
+        if (EEPROM_deferredIds[i] == id) {
+            if (index) *index = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Drop a deferred save that a newer save replaces
+static void EEPROM_dropDeferred(uint16_t id) {
+    uint8_t i;
+
+    if (!EEPROM_findDeferred(id, &i)) return;
+
+    EEPROM_deferredCount--;
+    EEPROM_deferredIds[i] = EEPROM_deferredIds[EEPROM_deferredCount];
+    EEPROM_deferredValues[i] = EEPROM_deferredValues[EEPROM_deferredCount];
+    EEPROM_deferredDue[i] = EEPROM_deferredDue[EEPROM_deferredCount];
+}
+
+// Queue a save, or replace the queued value of the variable
+static uint8_t EEPROM_queueDeferred(uint16_t id, uint16_t value, uint32_t due) {
+    uint8_t i;
+
+    if (EEPROM_findDeferred(id, &i)) {
+        EEPROM_deferredValues[i] = value;
+    } else {
+        if (EEPROM_deferredCount >= EEPROM_DEFER_DEPTH) return EEPROM_ERROR;
+
+        EEPROM_deferredIds[EEPROM_deferredCount] = id;
+        EEPROM_deferredValues[EEPROM_deferredCount] = value;
+        EEPROM_deferredDue[EEPROM_deferredCount] = due;
+        EEPROM_deferredCount++;
+    }
+
+    // Reads see held values, so does the ISR cache
+#if EEPROM_ISR_CACHE
+    EEPROM_cachePublish(&id, &value, 1);
+#endif
+    return EEPROM_OK;
+}
+
+// Commit a batch sorted by shard and ID, each ID at most once
+static uint8_t EEPROM_commit(uint16_t* ids, uint16_t* values, uint8_t count) {
+#if EEPROM_WRITE_COMBINE
+    uint8_t expired = EEPROM_combineExpire();
+    if (expired != EEPROM_OK) return expired;
+#endif
+
+    if (!EEPROM_dryRun) {
+        for (uint8_t j = 0; j < count; j++) {
+            EEPROM_dropDeferred(ids[j]);
+        }
+    }
+
+    // Saved values go to the shards, compaction may move them on
+    for (uint8_t j = 0; j < count; j++) {
+#if EEPROM_COLD_TIER
+        EEPROM_noteSave(ids[j]);
+#endif
+        if (!EEPROM_dryRun) EEPROM_dirMark(EEPROM_hotDir, ids[j]);
+    }
+
+    // Every shard gets its own run of the batch
+    for (uint8_t first = 0; first < count;) {
+        uint8_t shard = EEPROM_SHARD_OF(ids[first]);
+        uint8_t end = first + 1;
+
+        while (end < count && EEPROM_SHARD_OF(ids[end]) == shard) end++;
+
+        uint8_t status = EEPROM_saveShard(shard, ids + first, values + first,
+                                          end - first);
+        if (status != EEPROM_OK) return status;
+
+        first = end;
+    }
+
+    // The whole batch becomes visible to ISRs at once
+#if EEPROM_ISR_CACHE
+    EEPROM_cachePublish(ids, values, count);
+#endif
+    return EEPROM_OK;
+}
+
+// Move keys[root] down the max-heap keys[0..n)
+static void EEPROM_siftDown(uint32_t* keys, uint8_t root, uint8_t n) {
+    for (;;) {
+        uint16_t child = 2 * (uint16_t)root + 1;
+
+        if (child >= n) return;
+        if (child + 1 < n && keys[child + 1] > keys[child]) child++;
+        if (keys[root] >= keys[child]) return;
+
+        uint32_t key = keys[root];
+        keys[root] = keys[child];
+        keys[child] = key;
+        root = (uint8_t)child;
+    }
+}
+
+// Heapsort: O(n log n) without recursion or extra RAM
+static void EEPROM_sortKeys(uint32_t* keys, uint8_t n) {
+    for (uint8_t i = n / 2; i > 0; i--) EEPROM_siftDown(keys, i - 1, n);
+
+    for (uint8_t end = n; end > 1; end--) {
+        uint32_t key = keys[0];
+        keys[0] = keys[end - 1];
+        keys[end - 1] = key;
+        EEPROM_siftDown(keys, 0, end - 1);
+    }
+}
+
+// Save a batch of 8-bit IDs (ids8) or 16-bit keys (ids16). Every chunk of
+// up to EEPROM_BATCH_MAX saves is sorted by shard and ID, and only the last
+// value of an ID is committed.
+static uint8_t EEPROM_saveBatch(const uint8_t* ids8, const uint16_t* ids16,
+                                const uint16_t* values, uint8_t count) {
+    uint32_t keys[EEPROM_BATCH_MAX];
+    uint16_t sortedIds[EEPROM_BATCH_MAX];
+    uint16_t sortedValues[EEPROM_BATCH_MAX];
+
+    // Reserved keys would read as a generation record or an empty slot
+    for (uint8_t j = 0; j < count; j++) {
+        if (!ids8 && ids16[j] >= EEPROM_KEY_CLEAR) return EEPROM_ERROR;
+    }
+
+    EEPROM_stats.saves += count;
+
+    for (uint8_t first = 0; first < count;) {
+        uint8_t n = count - first;
+        uint8_t unique = 0;
+
+        if (n > EEPROM_BATCH_MAX) n = EEPROM_BATCH_MAX;
+
+        // Shard, ID and position in one key, so equal IDs keep their order
+        for (uint8_t j = 0; j < n; j++) {
+            uint16_t id = ids8 ? ids8[first + j] : ids16[first + j];
+
+            keys[j] = ((uint32_t)EEPROM_SHARD_OF(id) << 24) |
+                      ((uint32_t)id << 8) | j;
+        }
+
+        EEPROM_sortKeys(keys, n);
+
+        // The last save of an ID wins
+        for (uint8_t j = 0; j < n; j++) {
+            if (j + 1 < n && (keys[j + 1] >> 8) == (keys[j] >> 8)) continue;
+
+            sortedIds[unique] = (uint16_t)(keys[j] >> 8);
+            sortedValues[unique] = values[first + (uint8_t)keys[j]];
+            unique++;
+        }
+
+        uint8_t status = EEPROM_commit(sortedIds, sortedValues, unique);
+        if (status != EEPROM_OK) return status;
+
+        first += n;
+    }
+
+    return EEPROM_OK;
+}
+
+// Save multiple variables at once
+uint8_t EEPROM_saveKeys(uint16_t* ids, uint16_t* values, uint8_t count) {
+    return EEPROM_saveBatch(NULL, ids, values, count);
+}
+
+#if EEPROM_COALESCE_MS
+// Update rate of a variable, learned from its saves
+typedef struct {
+    uint16_t id;
+    uint32_t lastMs;      // Time of the last save
+    uint32_t intervalMs;  // Average time between saves, 0 until known
+} EEPROM_VarRate;
+
+static EEPROM_VarRate EEPROM_rates[EEPROM_CAPACITY];
+static uint8_t EEPROM_rateCount = 0;
+
+// Learn the save interval of a variable and return how long its saves may
+// be held, 0 for write-through
+static uint32_t EEPROM_coalesceWindow(uint16_t id, uint32_t now) {
+    uint8_t i;
+
+    for (i = 0; i < EEPROM_rateCount; i++) {
+        if (EEPROM_rates[i].id == id) break;
+    }
+
+    if (i == EEPROM_rateCount) {
+        // Untracked variables are simply written through
+        if (EEPROM_rateCount >= EEPROM_CAPACITY) return 0;
+        EEPROM_rates[i].id = id;
+        EEPROM_rates[i].lastMs = now;
+        EEPROM_rates[i].intervalMs = 0;
+        EEPROM_rateCount++;
+        return 0;
+    }
+
+    // Moving average over about four saves
+    uint32_t sample = now - EEPROM_rates[i].lastMs;
+    uint32_t interval = EEPROM_rates[i].intervalMs;
+
+    interval = interval ? (3 * interval + sample) / 4 : sample;
+    if (interval == 0) interval = 1;
+    EEPROM_rates[i].lastMs = now;
+    EEPROM_rates[i].intervalMs = interval;
+
+    // Only variables saved at least twice within the staleness bound are
+    // worth holding back
+    if (interval > EEPROM_COALESCE_MS / 2) return 0;
+
+    uint32_t window = interval * EEPROM_COALESCE_SAVES;
+    return window < EEPROM_COALESCE_MS ? window : EEPROM_COALESCE_MS;
+}
+
+// Commit the held saves whose window has run out as one batch
+static uint8_t EEPROM_commitDue(uint32_t now) {
+    uint16_t ids[EEPROM_DEFER_DEPTH];
+    uint16_t values[EEPROM_DEFER_DEPTH];
+    uint32_t due[EEPROM_DEFER_DEPTH];
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < EEPROM_deferredCount; i++) {
+        if (EEPROM_deferredDue[i] == 0 ||
+            (int32_t)(now - EEPROM_deferredDue[i]) < 0) {
+            continue;
+        }
+
+        ids[count] = EEPROM_deferredIds[i];
+        values[count] = EEPROM_deferredValues[i];
+        due[count] = EEPROM_deferredDue[i];
+        count++;
+    }
+    if (count == 0) return EEPROM_OK;
+
+    uint8_t status = EEPROM_saveKeys(ids, values, count);
+
+    // Keep the saves held if they could not be written
+    if (status != EEPROM_OK) {
+        for (uint8_t i = 0; i < count; i++) {
+            EEPROM_queueDeferred(ids[i], values[i], due[i]);
+        }
+    }
+
+    return status;
+}
+#endif
+
+// Save a variable
+uint8_t EEPROM_saveKey(uint16_t id, uint16_t value) {
+#if EEPROM_COALESCE_MS
+    if (!EEPROM_dryRun) {
+        uint32_t now = EEPROM_nowMs();
+
+        uint8_t status = EEPROM_commitDue(now);
+        if (status != EEPROM_OK) return status;
+
+        uint32_t window = EEPROM_coalesceWindow(id, now);
+
+        // Hold saves of chatty variables in RAM, later saves replace the
+        // held value until its window runs out
+        if (window) {
+            uint32_t due = now + window;
+
+            if (EEPROM_findDeferred(id, NULL)) EEPROM_stats.coalesced++;
+            if (due == 0) due = 1;
+            if (EEPROM_queueDeferred(id, value, due) == EEPROM_OK) {
+                return EEPROM_OK;
+            }
+        }
+    }
+#endif
+
+    return EEPROM_saveKeys(&id, &value, 1);
+}
+
+uint8_t EEPROM_saveVar(uint8_t id, uint16_t value) {
+    return EEPROM_saveKey(id, value);
+}
+
+// Save multiple 8-bit IDs
+uint8_t EEPROM_saveVars(uint8_t* ids, uint16_t* values, uint8_t count) {
+    return EEPROM_saveBatch(ids, NULL, values, count);
+}
+
+// Save a variable only if it fits in a time budget, defer it otherwise
+uint8_t EEPROM_saveVarWithin(uint8_t id, uint16_t value, uint32_t budget_us) {
+    EEPROM_Cost cost;
+
+    uint8_t status = EEPROM_estimateCost(id, value, &cost);
+    if (status != EEPROM_OK) return status;
+
+    // Written on its own, as estimated: held saves that are due wait for
+    // the next save or EEPROM_flushDeferred
+    if (cost.us <= budget_us) {
+        uint16_t key = id;
+
+        return EEPROM_saveKeys(&key, &value, 1);
+    }
+
+    // Too slow for now, keep the newest value for EEPROM_flushDeferred
+    status = EEPROM_queueDeferred(id, value, 0);
+    if (status != EEPROM_OK) return status;
+
+    return EEPROM_DEFERRED;
+}
+
+// Commit all deferred saves as one batch
+uint8_t EEPROM_flushDeferred(void) {
+    uint16_t ids[EEPROM_DEFER_DEPTH];
+    uint16_t values[EEPROM_DEFER_DEPTH];
+    uint32_t due[EEPROM_DEFER_DEPTH];
+    uint8_t count = EEPROM_deferredCount;
+
+#if EEPROM_WRITE_COMBINE
+    uint8_t expired = EEPROM_combineExpire();
+    if (expired != EEPROM_OK) return expired;
+#endif
+
+    if (count == 0) return EEPROM_OK;
+
+    for (uint8_t i = 0; i < count; i++) {
+        ids[i] = EEPROM_deferredIds[i];
+        values[i] = EEPROM_deferredValues[i];
+        due[i] = EEPROM_deferredDue[i];
+    }
+
+    uint8_t status = EEPROM_saveKeys(ids, values, count);
+
+    // Keep the saves queued if they could not be written
+    if (status != EEPROM_OK) {
+        for (uint8_t i = 0; i < count; i++) {
+            EEPROM_deferredIds[i] = ids[i];
+            EEPROM_deferredValues[i] = values[i];
+            EEPROM_deferredDue[i] = due[i];
+        }
+        EEPROM_deferredCount = count;
+    }
+
+    return status;
+}
+
+// Number of saves waiting for EEPROM_flushDeferred
+uint8_t EEPROM_deferredPending(void) { return EEPROM_deferredCount; }
+
+// Read a variable by ID
+uint16_t EEPROM_readKey(uint16_t id) {
+    uint16_t value;
+    uint8_t i;
+
+    // Reserved keys are never saved, EEPROM_KEY_CLEAR holds the generation
+    if (id >= EEPROM_KEY_CLEAR) return 0xFFFF;
+
+    // A deferred save holds the newest value
+    if (EEPROM_findDeferred(id, &i)) {
+        return EEPROM_deferredValues[i];
+    }
+
+#if EEPROM_WRITE_COMBINE
+    if (EEPROM_combineFind(id, &value)) return value;
+#endif
+
+    if (EEPROM_findVar(id, &value)) {
+        return value;
+    }
+
+    return 0xFFFF;  // Not found/invalid
+}
+
+uint16_t EEPROM_readVar(uint8_t id) { return EEPROM_readKey(id); }
+
+// Check if variable exists
+uint8_t EEPROM_keyExists(uint16_t id) {
+    if (id >= EEPROM_KEY_CLEAR) return 0;
+    if (EEPROM_findDeferred(id, NULL)) return 1;
+#if EEPROM_WRITE_COMBINE
+    if (EEPROM_combineFind(id, NULL)) return 1;
+#endif
+    return EEPROM_findVar(id, NULL);
+}
+
+uint8_t EEPROM_varExists(uint8_t id) { return EEPROM_keyExists(id); }
+
+#if EEPROM_ISR_CACHE
+// Mirror a key in the ISR cache
+uint8_t EEPROM_cacheKey(uint16_t key) {
+    uint8_t count = EEPROM_cacheCount;
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (EEPROM_cacheKeys[i] == key) return EEPROM_OK;
+    }
+    if (count >= EEPROM_ISR_CACHE) return EEPROM_ERROR;
+
+    // Readers only look at the entry once the count covers it
+    uint16_t value = EEPROM_readKey(key);
+    EEPROM_cacheKeys[count] = key;
+    EEPROM_cacheValues[0][count] = value;
+    EEPROM_cacheValues[1][count] = value;
+    EEPROM_cacheCount = count + 1;
+
+    return EEPROM_OK;
+}
+
+// Find a key in the ISR cache
+static uint8_t EEPROM_cacheFind(uint16_t key, uint8_t* index) {
+    uint8_t count = EEPROM_cacheCount;
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (EEPROM_cacheKeys[i] == key) {
+            *index = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Read a cached key, from any context
+uint16_t EEPROM_readCached(uint16_t key) {
+    uint8_t i;
+    uint32_t seq;
+    uint16_t value;
+
+    if (!EEPROM_cacheFind(key, &i)) return 0xFFFF;
+
+    do {
+        seq = EEPROM_cacheSeq;
+        value = EEPROM_cacheValues[seq & 1][i];
+    } while (seq != EEPROM_cacheSeq);
+
+    return value;
+}
+
+// Read two cached keys saved together as one 32-bit value
+uint32_t EEPROM_readCached32(uint16_t key) {
+    uint8_t lo, hi;
+    uint32_t seq;
+    uint32_t value;
+
+    if (!EEPROM_cacheFind(key, &lo) ||
+        !EEPROM_cacheFind((uint16_t)(key + 1), &hi)) {
+        return 0xFFFFFFFF;
+    }
+
+    // Both halves come from the same copy, so they belong to one batch
+    do {
+        seq = EEPROM_cacheSeq;
+        value = EEPROM_cacheValues[seq & 1][lo] |
+                ((uint32_t)EEPROM_cacheValues[seq & 1][hi] << 16);
+    } while (seq != EEPROM_cacheSeq);
+
+    return value;
+}
+#endif
+
+// Delete a variable by appending a tombstone to its shard
+uint8_t EEPROM_deleteKey(uint16_t id) {
+    uint8_t shard = EEPROM_SHARD_OF(id);
+    uint32_t base = EEPROM_SHARD_ADDRESS(shard);
+    uint8_t status;
+
+    // A tombstone of a reserved key would void the generation record
+    if (id >= EEPROM_KEY_CLEAR) return EEPROM_ERROR;
+
+    if (!EEPROM_dryRun) EEPROM_dropDeferred(id);
+
+    // Tombstones are never staged, they go right after the staged records
+#if EEPROM_WRITE_COMBINE
+    status = EEPROM_combineFlush();
+    if (status != EEPROM_OK) return status;
+#endif
+
+    // Nothing stored, nothing to hide (a held value was just dropped)
+    if (!EEPROM_findVar(id, NULL)) {
+#if EEPROM_ISR_CACHE
+        EEPROM_cachePublish(&id, NULL, 1);
+#endif
+        return EEPROM_OK;
+    }
+
+    uint32_t currentAddr = EEPROM_findEnd(base);
+
+    // The tombstone of a variable only the cold tier holds adds it to the
+    // shard, which may need the room of deleted variables
+    uint8_t crowded = EEPROM_isInitialized(base) &&
+                      EEPROM_hasNewKey(base, currentAddr, &id, 1) &&
+                      EEPROM_shardVars(shard, 0, &id, 1) > EEPROM_MAX_VARS;
+
+    // Make room first when the shard is full (or only the cold tier holds
+    // the variable so far)
+    if (!EEPROM_isInitialized(base) || crowded ||
+        currentAddr + EEPROM_RECORD_SIZE > EEPROM_DATA_END(base)) {
+        status = EEPROM_compact(shard, NULL, NULL, 0);
+        if (status == EEPROM_OK) currentAddr = EEPROM_findEnd(base);
+        if (status == EEPROM_OK && crowded &&
+            EEPROM_shardVars(shard, 0, &id, 1) > EEPROM_MAX_VARS) {
+            status = EEPROM_ERROR;
+        }
+    } else {
+        status = EEPROM_OK;
+    }
+
+    if (!EEPROM_dryRun) EEPROM_dirMark(EEPROM_hotDir, id);
+
+    if (status == EEPROM_OK) status = EEPROM_writeTombstone(currentAddr, id);
+
+#if EEPROM_ISR_CACHE
+    if (status == EEPROM_OK) EEPROM_cachePublish(&id, NULL, 1);
+#endif
+    return status;
+}
+
+uint8_t EEPROM_deleteVar(uint8_t id) { return EEPROM_deleteKey(id); }
+
+// Collect committed values of a variable in one page, newest first. Stops
+// at the newest tombstone and sets deleted.
+static uint8_t EEPROM_pageHistory(uint32_t base, uint16_t id, uint16_t* out,
+                                  uint8_t n, uint8_t* deleted) {
+    uint8_t found = 0;
+
+    *deleted = 0;
+
+    if (!EEPROM_isInitialized(base) || !EEPROM_mayContain(base, id)) {
+        return 0;
+    }
+
+    uint32_t currentAddr = EEPROM_findEnd(base);
+
+    EEPROM_TRACE_BEGIN(EEPROM_TRACE_SCAN, base);
+
+    // Walk the log backwards from the newest record
+    while (currentAddr > EEPROM_DATA_START(base) && found < n) {
+        currentAddr -= EEPROM_RECORD_SIZE;
+
+        uint16_t entryId = *(volatile uint16_t*)currentAddr;
+
+        // Older records belong to an earlier generation
+        if (EEPROM_isGeneration(currentAddr)) break;
+        if (entryId != id) continue;
+
+        if (EEPROM_recordValid(currentAddr)) {
+            out[found++] = *(volatile uint16_t*)(currentAddr + 2);
+        } else if (EEPROM_isTombstone(currentAddr)) {
+            *deleted = 1;
+            break;
+        }
+    }
+
+    EEPROM_TRACE_END(EEPROM_TRACE_SCAN, base);
+    return found;
+}
+
+// Read the last committed values of a variable, newest first
+uint8_t EEPROM_readKeyHistory(uint16_t id, uint16_t* out, uint8_t n) {
+    uint8_t deleted;
+
+    if (id >= EEPROM_KEY_CLEAR) return 0;
+
+    // The history is read from flash
+#if EEPROM_WRITE_COMBINE
+    if (EEPROM_combineFlush() != EEPROM_OK) return 0;
+#endif
+
+    uint8_t found = EEPROM_pageHistory(EEPROM_BASE_OF(id), id, out, n,
+                                       &deleted);
+
+    // Values older than a deletion are gone
+    if (deleted) return found;
+
+#if EEPROM_COLD_EXTERNAL
+    // Older values continue in the cold tier
+    if (EEPROM_coldDevice && found < n) {
+        found += EEPROM_extReadHistory(EEPROM_coldDevice, id, out + found,
+                                       n - found);
+    }
+#elif EEPROM_COLD_PAGE
+    // Older values continue in the cold page
+    found += EEPROM_pageHistory(EEPROM_COLD_ADDRESS, id, out + found,
+                                n - found, &deleted);
+#endif
+
+    return found;
+}
+
+uint8_t EEPROM_readHistory(uint8_t id, uint16_t* out, uint8_t n) {
+    return EEPROM_readKeyHistory(id, out, n);
+}
+
+// Get the flash operation statistics
+void EEPROM_getStats(EEPROM_Stats* stats) { *stats = EEPROM_stats; }
+
+// Reset the flash operation statistics
+void EEPROM_resetStats(void) {
+    EEPROM_stats.saves = 0;
+    EEPROM_stats.erases = 0;
+    EEPROM_stats.programs = 0;
+    EEPROM_stats.recordsCopied = 0;
+    EEPROM_stats.lookups = 0;
+    EEPROM_stats.pagesScanned = 0;
+    EEPROM_stats.coalesced = 0;
+    EEPROM_stats.blocks = 0;
+    EEPROM_stats.unpersistedMax = EEPROM_stats.unpersisted;
+}
+
+// Enable or disable dry-run mode
+void EEPROM_setDryRun(uint8_t enable) { EEPROM_dryRun = enable; }
+
+// Estimate the flash operations a save would perform
+uint8_t EEPROM_estimateCost(uint8_t id, uint16_t value, EEPROM_Cost* cost) {
+    EEPROM_Stats saved = EEPROM_stats;
+    uint8_t dryRun = EEPROM_dryRun;
+    uint8_t status;
+
+#if EEPROM_COLD_TIER
+    EEPROM_VarActivity activity[EEPROM_CAPACITY];
+    uint8_t activityCount = EEPROM_activityCount;
+
+    for (uint8_t i = 0; i < activityCount; i++) {
+        activity[i] = EEPROM_activity[i];
+    }
+#endif
+
+    // Run the real save path without touching flash
+    EEPROM_dryRun = 1;
+    status = EEPROM_saveKey(id, value);
+    EEPROM_dryRun = dryRun;
+
+    cost->erases = (uint16_t)(EEPROM_stats.erases - saved.erases);
+    cost->programs = (uint16_t)(EEPROM_stats.programs - saved.programs);
+    cost->us = (uint32_t)cost->erases * EEPROM_ERASE_US +
+               (uint32_t)cost->programs * EEPROM_PROGRAM_US;
+
+    // The estimate leaves no trace in the statistics or save counts
+    EEPROM_stats = saved;
+#if EEPROM_COLD_TIER
+    for (uint8_t i = 0; i < activityCount; i++) {
+        EEPROM_activity[i] = activity[i];
+    }
+    EEPROM_activityCount = activityCount;
+#endif
+
+    return status;
+}
+
+// Commit an update script as one batch
+uint8_t EEPROM_applyUpdate(const uint8_t* script, uint16_t length) {
+    uint16_t ids[EEPROM_CAPACITY];
+    uint16_t values[EEPROM_CAPACITY];
+    uint16_t check = 0;
+
+    if (length < 4) return EEPROM_ERROR;
+
+    uint16_t count = (uint16_t)(script[0] | (script[1] << 8));
+    if (count > EEPROM_CAPACITY || count > EEPROM_UPDATE_MAX ||
+        length != EEPROM_UPDATE_WORDS(count) * 2) {
+        return EEPROM_ERROR;
+    }
+
+    // Verify the script before touching flash
+    for (uint16_t i = 0; i < length; i += 2) {
+        check ^= (uint16_t)(script[i] | (script[i + 1] << 8));
+    }
+    if (check != 0) return EEPROM_ERROR;
+
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t* pair = script + 2 + 4 * i;
+        ids[i] = (uint16_t)(pair[0] | (pair[1] << 8));
+        values[i] = (uint16_t)(pair[2] | (pair[3] << 8));
+    }
+
+    if (count == 0) return EEPROM_OK;
+
+    return EEPROM_saveKeys(ids, values, (uint8_t)count);
+}
+
+#if EEPROM_CRASH_PAGE
+// Set by EEPROM_crashRead, after which maintenance may erase the page
+static uint8_t EEPROM_crashTaken = 0;
+
+// Busy wait inside EEPROM_crashSave, which must not call into flash
+#define EEPROM_CRASH_WAIT(ok)                                 \
+    do {                                                      \
+        uint32_t spins = 50000;                               \
+                                                              \
+        while ((FLASH->STATR & FLASH_STATR_BSY) && --spins) { \
+        }                                                     \
+        if (spins == 0) ok = 0;                               \
+    } while (0)
+
+// Save a snapshot into the first erased slot of the crash page. Everything
+// it needs is inlined, so it keeps running while the flash is busy and
+// does not depend on the state of the code that faulted.
+EEPROM_RAMFUNC uint8_t EEPROM_crashSave(const uint32_t* words,
+                                        uint8_t count) {
+    uint32_t slot = EEPROM_CRASH_ADDRESS;
+    uint32_t check = 0;
+    uint8_t ok = 1;
+
+    // Interrupts are masked until the snapshot is written, then restored
+    uint32_t mstatus = __get_MSTATUS();
+    __disable_irq();
+
+    if (count > EEPROM_CRASH_WORDS) count = EEPROM_CRASH_WORDS;
+
+    while (*(volatile uint32_t*)slot != 0xFFFFFFFF) {
+        slot += EEPROM_CRASH_SLOT;
+        if (slot >= EEPROM_CRASH_ADDRESS + EEPROM_PAGE_SIZE) {
+            __set_MSTATUS(mstatus);
+            return EEPROM_ERROR;
+        }
+    }
+
+    FLASH->KEYR = FLASH_KEY1;
+    FLASH->KEYR = FLASH_KEY2;
+    FLASH->MODEKEYR = FLASH_KEY1;
+    FLASH->MODEKEYR = FLASH_KEY2;
+
+    // One fast page program per 64-byte block, as in EEPROM_programBlock
+    for (uint8_t block = 0; block < EEPROM_CRASH_BLOCKS && ok; block++) {
+        uint32_t base = slot + block * 64;
+        volatile uint32_t* dest = (volatile uint32_t*)base;
+
+        FLASH->CTLR = FLASH_CTLR_PAGE_PG;
+        FLASH->CTLR = FLASH_CTLR_PAGE_PG | FLASH_CTLR_BUF_RST;
+        FLASH->ADDR = base;
+        EEPROM_CRASH_WAIT(ok);
+
+        for (uint8_t i = 0; i < 16 && ok; i++) {
+            uint8_t n = (uint8_t)(block * 16 + i);
+            uint32_t word = 0;
+
+            if (n == 0) {
+                word = EEPROM_CRASH_MARKER | ((uint32_t)count << 16);
+            } else if (n == EEPROM_CRASH_SLOT / 4 - 1) {
+                word = check;
+            } else if (n <= count) {
+                word = words[n - 1];
+            }
+
+            check ^= word;
+            dest[i] = word;
+            FLASH->CTLR = FLASH_CTLR_PAGE_PG | FLASH_CTLR_BUF_LOAD;
+            EEPROM_CRASH_WAIT(ok);
+        }
+
+        if (ok) {
+            FLASH->CTLR = FLASH_CTLR_PAGE_PG | FLASH_CTLR_STRT;
+            EEPROM_CRASH_WAIT(ok);
+        }
+    }
+
+    FLASH->CTLR &= ~FLASH_CTLR_PAGE_PG;
+    FLASH->CTLR |= FLASH_CTLR_FLOCK;
+    FLASH->CTLR |= FLASH_CTLR_LOCK;
+
+    // The words of a complete slot XOR to 0
+    check = 0;
+    for (uint8_t i = 0; i < EEPROM_CRASH_SLOT / 4; i++) {
+        check ^= ((volatile uint32_t*)slot)[i];
+    }
+
+    __set_MSTATUS(mstatus);
+    return (ok && check == 0) ? EEPROM_OK : EEPROM_ERROR;
+}
+
+// Check a crash slot: marker, word count and XOR check
+static uint8_t EEPROM_crashValid(uint32_t slot) {
+    uint32_t header = *(volatile uint32_t*)slot;
+    uint32_t check = 0;
+
+    if ((header & 0xFFFF) != EEPROM_CRASH_MARKER ||
+        (header >> 16) > EEPROM_CRASH_WORDS) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < EEPROM_CRASH_SLOT / 4; i++) {
+        check ^= ((volatile uint32_t*)slot)[i];
+    }
+
+    return check == 0;
+}
+
+// Read the newest crash snapshot
+uint8_t EEPROM_crashRead(uint32_t* words) {
+    uint8_t count = 0;
+
+    EEPROM_crashTaken = 1;
+
+    for (uint32_t slot = EEPROM_CRASH_ADDRESS;
+         slot < EEPROM_CRASH_ADDRESS + EEPROM_PAGE_SIZE;
+         slot += EEPROM_CRASH_SLOT) {
+        if (*(volatile uint32_t*)slot == 0xFFFFFFFF) break;
+        if (!EEPROM_crashValid(slot)) continue;
+
+        count = (uint8_t)(*(volatile uint32_t*)slot >> 16);
+        for (uint8_t i = 0; i < count; i++) {
+            words[i] = ((volatile uint32_t*)slot)[i + 1];
+        }
+    }
+
+    return count;
+}
+
+// Check if the crash page must be erased: it is not erased, and it holds
+// no snapshot or the snapshot was read
+static uint8_t EEPROM_crashStale(void) {
+    uint8_t erased = 1;
+    uint8_t held = 0;
+
+    for (uint32_t addr = EEPROM_CRASH_ADDRESS;
+         addr < EEPROM_CRASH_ADDRESS + EEPROM_PAGE_SIZE; addr += 4) {
+        if (*(volatile uint32_t*)addr != 0xFFFFFFFF) erased = 0;
+        if ((addr - EEPROM_CRASH_ADDRESS) % EEPROM_CRASH_SLOT == 0 &&
+            EEPROM_crashValid(addr)) {
+            held = 1;
+        }
+    }
+
+    return !erased && (EEPROM_crashTaken || !held);
+}
+#endif
+
+#if EEPROM_COLD_TIER
+// Check if a shard holds a variable that turned cold
+static uint8_t EEPROM_hasCold(uint32_t base) {
+    uint32_t endAddr = EEPROM_findEnd(base);
+
+    for (uint32_t addr = EEPROM_DATA_START(base); addr < endAddr;
+         addr += EEPROM_RECORD_SIZE) {
+        uint16_t id = *(volatile uint16_t*)addr;
+
+        if (id == EEPROM_KEY_CLEAR) continue;
+        if (EEPROM_recordValid(addr) && EEPROM_isCold(id)) return 1;
+    }
+
+    return 0;
+}
+#endif
+
+// Check if a page still holds records of an earlier generation: a marker
+// but no longer initialized, or (shard 0) a generation record after the
+// first slot
+static uint8_t EEPROM_hasVoid(uint32_t base) {
+    if (*(volatile uint16_t*)base != EEPROM_MARKER) return 0;
+    if (!EEPROM_isInitialized(base)) return 1;
+
+    uint32_t endAddr = EEPROM_findEnd(base);
+
+    for (uint32_t addr = EEPROM_DATA_START(base) + EEPROM_RECORD_SIZE;
+         addr < endAddr; addr += EEPROM_RECORD_SIZE) {
+        if (EEPROM_isGeneration(addr)) return 1;
+    }
+
+    return 0;
+}
+
+// Compact the shards holding records that EEPROM_clear voided or, with a
+// cold tier, cold variables, which moves those to the cold tier ahead of
+// the next compaction a save would trigger. Void pages of other shards and
+// the cold page are erased, and so is a crash page that was read.
+uint8_t EEPROM_maintain(void) {
+    uint8_t status;
+
+#if EEPROM_WRITE_COMBINE
+    status = EEPROM_combineFlush();
+    if (status != EEPROM_OK) return status;
+#endif
+
+    for (uint8_t page = 0; page < EEPROM_PAGES; page++) {
+        uint32_t base = EEPROM_SHARD_ADDRESS(page);
+
+        if (page > 0 && EEPROM_hasVoid(base)) {
+            // A blank page is started again by its next save
+            status = EEPROM_erasePage(base);
+            if (status != EEPROM_OK) return status;
+            continue;
+        }
+
+        if (page >= EEPROM_SHARDS || !EEPROM_isInitialized(base)) continue;
+
+#if EEPROM_COLD_TIER
+        if (!EEPROM_hasVoid(base) && !EEPROM_hasCold(base)) continue;
+#else
+        if (!EEPROM_hasVoid(base)) continue;
+#endif
+
+        status = EEPROM_compact(page, NULL, NULL, 0);
+        if (status != EEPROM_OK) return status;
+    }
+
+#if EEPROM_CRASH_PAGE
+    // Keep an erased crash page ready for the next fault
+    if (EEPROM_crashStale()) {
+        status = EEPROM_erasePage(EEPROM_CRASH_ADDRESS);
+        if (status != EEPROM_OK) return status;
+
+        if (!EEPROM_dryRun) EEPROM_crashTaken = 0;
+    }
+#endif
+
+    return EEPROM_OK;
+}
+
+// Start a new generation of the store with one generation record in shard
+// 0, which voids every record written before it at once
+uint8_t EEPROM_clear(void) {
+    uint32_t base = EEPROM_SHARD_ADDRESS(0);
+    uint16_t gen = EEPROM_currentGen() + 1;
+    uint8_t status;
+
+    // Pages without a generation record are generation 0, so the counter
+    // must not wrap around to it
+    if (gen == 0) return EEPROM_format();
+
+    // The generation record goes after the staged records
+#if EEPROM_WRITE_COMBINE
+    status = EEPROM_combineFlush();
+    if (status != EEPROM_OK) return status;
+#endif
+
+    if (!EEPROM_dryRun) {
+        EEPROM_deferredCount = 0;
+        EEPROM_dirValid = 0;
+        EEPROM_resets++;
+    }
+
+#if EEPROM_COLD_EXTERNAL
+    // The external tier has no generations; an emptied device can only
+    // lose values, never bring back old ones
+    if (EEPROM_coldDevice && !EEPROM_dryRun) {
+        status = EEPROM_extFormat(EEPROM_coldDevice);
+        if (status != EEPROM_OK) return status;
+    }
+#endif
+
+    uint32_t currentAddr = EEPROM_findEnd(base);
+
+    if (EEPROM_isInitialized(base) &&
+        currentAddr + EEPROM_RECORD_SIZE <= EEPROM_DATA_END(base)) {
+        status = EEPROM_writeRecord(currentAddr, EEPROM_KEY_CLEAR, gen);
+    } else {
+        // Shard 0 is full or blank: start it over with the record
+        status = EEPROM_startPage(base, EEPROM_SUMMARY_NONE, gen);
+    }
+
+    if (status != EEPROM_OK) return status;
+
+    if (!EEPROM_dryRun) EEPROM_generation = gen;
+#if EEPROM_ISR_CACHE
+    EEPROM_cachePublish(NULL, NULL, 0);
+#endif
+    return EEPROM_OK;
+}
+
+uint16_t EEPROM_resetCount(void) { return EEPROM_resets; }
+
+#if EEPROM_COLD_EXTERNAL
+// Select and mount the external device holding the cold tier
+uint8_t EEPROM_setColdDevice(EEPROM_ExtDevice* dev) {
+    EEPROM_coldDevice = dev;
+    EEPROM_dirValid = 0;
+
+    return EEPROM_extInit(dev);
+}
+#endif
+
+#if EEPROM_LOG_PAGES
+#define EEPROM_LOG_PAGE_ADDRESS(page) \
+    (EEPROM_LOG_ADDRESS + (uint32_t)(page) * EEPROM_PAGE_SIZE)
+#define EEPROM_LOG_PAGE_OF(addr) \
+    ((uint8_t)(((addr) - EEPROM_LOG_ADDRESS) / EEPROM_PAGE_SIZE))
+#define EEPROM_LOG_OFFSET(addr) \
+    (((addr) - EEPROM_LOG_ADDRESS) % EEPROM_PAGE_SIZE)
+
+static EEPROM_LogStats EEPROM_logStats = {0, 0, 0, 0, 0, 0};
+
+// Two block buffers: the application fills one while the other waits for
+// (or is in) programming. Only the filling side changes the fill state and
+// only EEPROM_logService clears EEPROM_logFull.
+static uint32_t EEPROM_logBuffers[2][EEPROM_LOG_BLOCK / 4];
+static volatile uint8_t EEPROM_logFill = 0;      // Buffer being filled
+static volatile uint8_t EEPROM_logFillLen = 0;   // Bytes in it
+static volatile uint32_t EEPROM_logFillAddr = 0; // Block it goes to
+static volatile uint8_t EEPROM_logFull = 0;      // The other buffer is due
+static volatile uint32_t EEPROM_logFullAddr = 0; // Block it goes to
+static uint16_t EEPROM_logSeq = 0;               // Sequence of the fill page
+static uint8_t EEPROM_logReady = 0;
+
+// Newest programmed data: its page and the bytes used there (0 if none)
+static uint8_t EEPROM_logEndPage = 0;
+static uint16_t EEPROM_logEndOffset = 0;
+
+// Check if a flash range reads as erased
+static uint8_t EEPROM_logErased(uint32_t addr, uint16_t size) {
+    for (uint16_t i = 0; i < size; i += 4) {
+        if (*(volatile uint32_t*)(addr + i) != 0xFFFFFFFF) return 0;
+    }
+
+    return 1;
+}
+
+// Erase a log page unless it already is
+static uint8_t EEPROM_logErase(uint8_t page) {
+    uint32_t base = EEPROM_LOG_PAGE_ADDRESS(page);
+
+    if (EEPROM_logErased(base, EEPROM_PAGE_SIZE)) return EEPROM_OK;
+
+    EEPROM_logStats.erases++;
+    return EEPROM_erasePage(base);
+}
+
+// Point the fill buffer at a block, a page starts with its header
+static void EEPROM_logOpen(uint32_t addr) {
+    uint8_t* buffer = (uint8_t*)EEPROM_logBuffers[EEPROM_logFill];
+
+    EEPROM_logFillAddr = addr;
+    EEPROM_logFillLen = 0;
+
+    if (EEPROM_LOG_OFFSET(addr) == 0) {
+        EEPROM_logSeq++;
+        buffer[0] = (uint8_t)EEPROM_LOG_MARKER;
+        buffer[1] = (uint8_t)(EEPROM_LOG_MARKER >> 8);
+        buffer[2] = (uint8_t)EEPROM_logSeq;
+        buffer[3] = (uint8_t)(EEPROM_logSeq >> 8);
+        EEPROM_logFillLen = EEPROM_LOG_HEADER_SIZE;
+    }
+}
+
+// Hand the filled buffer to EEPROM_logService and fill the other one
+static uint8_t EEPROM_logSwap(void) {
+    uint32_t next = EEPROM_logFillAddr + EEPROM_LOG_BLOCK;
+
+    if (EEPROM_logFull) return 0;
+
+    if (next == EEPROM_LOG_PAGE_ADDRESS(EEPROM_LOG_PAGES)) {
+        next = EEPROM_LOG_ADDRESS;
+    }
+
+    EEPROM_logFullAddr = EEPROM_logFillAddr;
+    EEPROM_logFill ^= 1;
+    EEPROM_logOpen(next);
+    EEPROM_logFull = 1;
+
+    return 1;
+}
+
+// Mount the log
+uint8_t EEPROM_logInit(uint8_t clear) {
+    uint8_t status;
+    uint8_t found = 0;
+
+    EEPROM_logReady = 0;
+    EEPROM_logFull = 0;
+    EEPROM_logEndPage = 0;
+    EEPROM_logEndOffset = 0;
+
+    // The newest page has the highest sequence number
+    for (uint8_t page = 0; page < EEPROM_LOG_PAGES; page++) {
+        uint32_t base = EEPROM_LOG_PAGE_ADDRESS(page);
+
+        if (clear) {
+            status = EEPROM_logErase(page);
+            if (status != EEPROM_OK) return status;
+            continue;
+        }
+
+        if (*(volatile uint16_t*)base != EEPROM_LOG_MARKER) continue;
+
+        uint16_t seq = *(volatile uint16_t*)(base + 2);
+        if (!found || (int16_t)(seq - EEPROM_logSeq) > 0) {
+            EEPROM_logEndPage = page;
+            EEPROM_logSeq = seq;
+            found = 1;
+        }
+    }
+
+    uint8_t page = EEPROM_logEndPage;
+    uint32_t base = EEPROM_LOG_PAGE_ADDRESS(page);
+
+    if (found) {
+        // The last block that is not erased ends the data
+        uint16_t offset = EEPROM_PAGE_SIZE;
+
+        while (EEPROM_logErased(base + offset - EEPROM_LOG_BLOCK,
+                                EEPROM_LOG_BLOCK)) {
+            offset -= EEPROM_LOG_BLOCK;
+        }
+        EEPROM_logEndOffset = offset;
+    } else {
+        status = EEPROM_logErase(page);
+        if (status != EEPROM_OK) return status;
+        EEPROM_logSeq = 0xFFFF;
+    }
+
+    // Keep the next page erased
+    status = EEPROM_logErase((uint8_t)((page + 1) % EEPROM_LOG_PAGES));
+    if (status != EEPROM_OK) return status;
+
+    if (!found) {
+        EEPROM_logOpen(base);
+    } else if (EEPROM_logEndOffset == EEPROM_PAGE_SIZE) {
+        EEPROM_logOpen(
+            EEPROM_LOG_PAGE_ADDRESS((page + 1) % EEPROM_LOG_PAGES));
+    } else {
+        EEPROM_logOpen(base + EEPROM_logEndOffset);
+    }
+
+    EEPROM_logReady = 1;
+    return EEPROM_OK;
+}
+
+// Append bytes to the log
+uint8_t EEPROM_logWrite(const void* data, uint16_t len) {
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    if (!EEPROM_logReady) return EEPROM_ERROR;
+
+    for (uint16_t i = 0; i < len; i++) {
+        // Both buffers full: the rest of the write is lost
+        if (EEPROM_logFillLen == EEPROM_LOG_BLOCK && !EEPROM_logSwap()) {
+            EEPROM_logStats.overruns++;
+            EEPROM_logStats.dropped += len - i;
+            return EEPROM_ERROR;
+        }
+
+        uint8_t* buffer = (uint8_t*)EEPROM_logBuffers[EEPROM_logFill];
+        buffer[EEPROM_logFillLen++] = bytes[i];
+        EEPROM_logStats.bytes++;
+    }
+
+    // Hand a full buffer over right away
+    if (EEPROM_logFillLen == EEPROM_LOG_BLOCK) EEPROM_logSwap();
+
+    return EEPROM_OK;
+}
+
+// Program the filled buffer. Entering a page erases the next one, which
+// leaves the time to fill this page for the erase before the stream needs
+// it.
+uint8_t EEPROM_logService(void) {
+    if (!EEPROM_logFull) return EEPROM_OK;
+
+    uint32_t addr = EEPROM_logFullAddr;
+    uint32_t start = EEPROM_TICKS();
+
+    uint8_t status =
+        EEPROM_programBlock(addr, EEPROM_logBuffers[EEPROM_logFill ^ 1]);
+
+    // The buffer is free again: the writer may fill it during the erase
+    EEPROM_logFull = 0;
+
+    if (status == EEPROM_OK) {
+        EEPROM_logStats.blocks++;
+        EEPROM_logEndPage = EEPROM_LOG_PAGE_OF(addr);
+        EEPROM_logEndOffset =
+            (uint16_t)(EEPROM_LOG_OFFSET(addr) + EEPROM_LOG_BLOCK);
+
+        if (EEPROM_LOG_OFFSET(addr) == 0) {
+            status = EEPROM_logErase(
+                (uint8_t)((EEPROM_logEndPage + 1) % EEPROM_LOG_PAGES));
+        }
+    }
+
+    EEPROM_logStats.busyTicks += EEPROM_TICKS() - start;
+
+    return status;
+}
+
+// Program the partly filled buffer
+uint8_t EEPROM_logFlush(void) {
+    uint8_t status = EEPROM_logService();
+    if (status != EEPROM_OK) return status;
+
+    // The writer may run from an ISR: keep it out while the buffer is padded
+    // and handed over
+    uint32_t mstatus = __get_MSTATUS();
+    __disable_irq();
+
+    // Nothing but a page header
+    uint8_t used = EEPROM_LOG_OFFSET(EEPROM_logFillAddr) == 0
+                       ? EEPROM_LOG_HEADER_SIZE
+                       : 0;
+    if (EEPROM_logFillLen == used) {
+        __set_MSTATUS(mstatus);
+        return EEPROM_OK;
+    }
+
+    uint8_t* buffer = (uint8_t*)EEPROM_logBuffers[EEPROM_logFill];
+    while (EEPROM_logFillLen < EEPROM_LOG_BLOCK) {
+        buffer[EEPROM_logFillLen++] = 0xFF;
+    }
+
+    EEPROM_logSwap();
+    __set_MSTATUS(mstatus);
+
+    return EEPROM_logService();
+}
+
+// Read stored bytes, oldest first
+uint32_t EEPROM_logRead(uint32_t pos, uint8_t* out, uint32_t len) {
+    uint8_t page = EEPROM_logEndPage;
+    uint8_t pages = 1;
+    uint32_t copied = 0;
+
+    if (EEPROM_logEndOffset == 0) return 0;
+
+    // Walk back over the pages written before the newest one
+    uint16_t seq = *(volatile uint16_t*)(EEPROM_LOG_PAGE_ADDRESS(page) + 2);
+
+    while (pages < EEPROM_LOG_PAGES - 1) {
+        uint8_t prev = page ? page - 1 : EEPROM_LOG_PAGES - 1;
+        uint32_t base = EEPROM_LOG_PAGE_ADDRESS(prev);
+
+        if (*(volatile uint16_t*)base != EEPROM_LOG_MARKER ||
+            *(volatile uint16_t*)(base + 2) != (uint16_t)(seq - 1)) {
+            break;
+        }
+
+        page = prev;
+        seq--;
+        pages++;
+    }
+
+    for (; pages > 0 && copied < len; pages--) {
+        uint32_t base = EEPROM_LOG_PAGE_ADDRESS(page) + EEPROM_LOG_HEADER_SIZE;
+        uint32_t size = (pages == 1 ? EEPROM_logEndOffset : EEPROM_PAGE_SIZE) -
+                        EEPROM_LOG_HEADER_SIZE;
+
+        if (pos >= size) {
+            pos -= size;
+        } else {
+            while (pos < size && copied < len) {
+                out[copied++] = *(volatile uint8_t*)(base + pos++);
+            }
+            pos = 0;
+        }
+
+        page = (uint8_t)((page + 1) % EEPROM_LOG_PAGES);
+    }
+
+    return copied;
+}
+
+// Get the logger statistics
+void EEPROM_logGetStats(EEPROM_LogStats* stats) { *stats = EEPROM_logStats; }
+
+// Reset the logger statistics
+void EEPROM_logResetStats(void) {
+    EEPROM_logStats = (EEPROM_LogStats){0, 0, 0, 0, 0, 0};
+}
+#endif
@@ -12,21 +12,146 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "EEPROM_layout.h"
+#if EEPROM_COLD_EXTERNAL
+#include "EEPROM_ext.h"
+#endif
 #include "ch32v003fun.h"
 
-// Status codes
-#define EEPROM_OK 0
-#define EEPROM_ERROR 1
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-// Address for storage - use a safe page
-#define EEPROM_ADDRESS 0x08003C00
+// Tracing hooks, called with an operation and its flash address at the
+// start and end of every flash primitive. Define EEPROM_TRACE_BEGIN and
+// EEPROM_TRACE_END (e.g. in funconfig.h) to toggle a GPIO or record cycle
+// counts; by default they compile to nothing.
+#define EEPROM_TRACE_UNLOCK 0        // Flash key sequence
+#define EEPROM_TRACE_ERASE 1         // Page erase
+#define EEPROM_TRACE_PROGRAM 2       // Half-word program
+#define EEPROM_TRACE_PAGE_PROGRAM 3  // Fast page program
+#define EEPROM_TRACE_VERIFY 4        // Read-back after erase or program
+#define EEPROM_TRACE_SCAN 5          // Walk over the records of a page
 
-// Initialize EEPROM
+#ifndef EEPROM_TRACE_BEGIN
+#define EEPROM_TRACE_BEGIN(op, addr) ((void)0)
+#endif
+
+#ifndef EEPROM_TRACE_END
+#define EEPROM_TRACE_END(op, addr) ((void)0)
+#endif
+
+// Saves EEPROM_saveVarWithin and coalescing can hold back
+#ifndef EEPROM_DEFER_DEPTH
+#define EEPROM_DEFER_DEPTH 4
+#endif
+
+// Saves EEPROM_saveVars sorts and deduplicates at once (4 + 2 + 2 bytes of
+// stack each); larger batches are committed in chunks of this size
+#ifndef EEPROM_BATCH_MAX
+#define EEPROM_BATCH_MAX 16
+#endif
+
+// Set to 1 to keep EEPROM_init from reading flash: each shard is indexed on
+// the first lookup of a key it holds, or by EEPROM_mountStep
+#ifndef EEPROM_LAZY_MOUNT
+#define EEPROM_LAZY_MOUNT 0
+#endif
+
+// Keys the ISR cache can mirror (EEPROM_cacheKey); 0 leaves it out
+#ifndef EEPROM_ISR_CACHE
+#define EEPROM_ISR_CACHE 0
+#endif
+
+// Adaptive coalescing: EEPROM_saveVar learns how often each variable is
+// saved and holds the saves of chatty ones in RAM, merging up to
+// EEPROM_COALESCE_SAVES of them into one record. A held value is written
+// at most EEPROM_COALESCE_MS after it was first held (checked on every
+// save). 0 keeps every save write-through.
+#ifndef EEPROM_COALESCE_MS
+#define EEPROM_COALESCE_MS 0
+#endif
+
+#ifndef EEPROM_COALESCE_SAVES
+#define EEPROM_COALESCE_SAVES 8
+#endif
+
+// Free-running tick counter used as the coalescing clock
+#ifndef EEPROM_TICKS
+#define EEPROM_TICKS() (SysTick->CNT)
+#define EEPROM_TICKS_PER_MS DELAY_MS_TIME
+#endif
+
+// Write combining: records appended by saves are staged in a RAM image of
+// the 64-byte flash block they go to, and the block is programmed with one
+// fast page program when it is full, after EEPROM_COMBINE_MS (checked by
+// saves, EEPROM_flushDeferred and EEPROM_serviceCombined; 0 never expires)
+// or by EEPROM_flushCombined. 0 programs every record half-word by half-word.
+#ifndef EEPROM_WRITE_COMBINE
+#define EEPROM_WRITE_COMBINE 0
+#endif
+
+#ifndef EEPROM_COMBINE_MS
+#define EEPROM_COMBINE_MS 100
+#endif
+
+// Placement of code that must run from RAM (EEPROM_crashSave). Linker
+// scripts for RISC-V (ch32v003fun's included) put .srodata input sections
+// into the RAM data that the startup code copies from flash; a .data
+// section would get data attributes and assembler warnings.
+#ifndef EEPROM_RAMFUNC
+#define EEPROM_RAMFUNC \
+    __attribute__((section(".srodata.ramfunc"), noinline))
+#endif
+
+// Flash operation statistics
+typedef struct {
+    uint32_t saves;           // Values passed to the save functions
+    uint32_t erases;          // Page erases
+    uint32_t programs;        // Half-word programs
+    uint32_t recordsCopied;   // Existing records rewritten by compaction
+    uint32_t lookups;         // Variable lookups
+    uint32_t pagesScanned;    // Pages scanned by lookups
+    uint32_t coalesced;       // Saves merged into a held value
+    uint32_t blocks;          // Fast page programs of combined records
+    uint32_t unpersisted;     // Records staged in RAM, lost on a reset
+    uint32_t unpersistedMax;  // Most records staged at once
+} EEPROM_Stats;
+
+// Modeled duration of flash operations in microseconds
+#ifndef EEPROM_ERASE_US
+#define EEPROM_ERASE_US 4000
+#endif
+
+#ifndef EEPROM_PROGRAM_US
+#define EEPROM_PROGRAM_US 100
+#endif
+
+// Expected cost of a save
+typedef struct {
+    uint16_t erases;    // Page erases
+    uint16_t programs;  // Half-word programs
+    uint32_t us;        // Modeled duration in microseconds
+} EEPROM_Cost;
+
+// Initialize EEPROM: index the store, unless EEPROM_LAZY_MOUNT is set
 void EEPROM_init(void);
 
+// Index one more page of the store, e.g. from the idle loop after a lazy
+// mount; returns 0 once the whole store is indexed
+uint8_t EEPROM_mountStep(void);
+
 // Format the flash page
 uint8_t EEPROM_format(void);
 
+// Factory reset without erasing: one record voids everything stored so
+// far. The old records are erased later by compaction or EEPROM_maintain.
+uint8_t EEPROM_clear(void);
+
+// Number of EEPROM_format and EEPROM_clear calls since start-up, so code
+// that keeps stored values in RAM can tell they are void
+uint16_t EEPROM_resetCount(void);
+
 // Variable operations
 uint8_t EEPROM_saveVar(uint8_t id, uint16_t value);
 uint16_t EEPROM_readVar(uint8_t id);
@@ -35,4 +160,125 @@ uint8_t EEPROM_saveVars(uint8_t *ids, uint16_t *values, uint8_t count);
 // Check if variable exists
 uint8_t EEPROM_varExists(uint8_t id);
 
+// Delete a variable; it reads as absent until saved again
+uint8_t EEPROM_deleteVar(uint8_t id);
+
+// Read up to n committed values of a variable, newest first
+uint8_t EEPROM_readHistory(uint8_t id, uint16_t* out, uint8_t n);
+
+// The same operations on 16-bit keys (0xFFFE and 0xFFFF are reserved: they
+// are never saved, found or deleted). The 8-bit functions above use keys
+// 0..255, so both APIs share one store.
+uint8_t EEPROM_saveKey(uint16_t key, uint16_t value);
+uint16_t EEPROM_readKey(uint16_t key);
+uint8_t EEPROM_saveKeys(uint16_t *keys, uint16_t *values, uint8_t count);
+uint8_t EEPROM_keyExists(uint16_t key);
+uint8_t EEPROM_deleteKey(uint16_t key);
+uint8_t EEPROM_readKeyHistory(uint16_t key, uint16_t* out, uint8_t n);
+
+// Flash operation statistics
+void EEPROM_getStats(EEPROM_Stats* stats);
+void EEPROM_resetStats(void);
+
+// Estimate the cost of saving a variable without writing it
+uint8_t EEPROM_estimateCost(uint8_t id, uint16_t value, EEPROM_Cost* cost);
+
+// Save only if the modeled cost fits in budget_us, otherwise queue the
+// value and return EEPROM_DEFERRED. Never starts an erase that would not fit.
+// The value is written as is, neither coalesced nor joined by held saves.
+uint8_t EEPROM_saveVarWithin(uint8_t id, uint16_t value, uint32_t budget_us);
+
+// Commit deferred saves, e.g. from the idle loop
+uint8_t EEPROM_flushDeferred(void);
+uint8_t EEPROM_deferredPending(void);
+
+#if EEPROM_WRITE_COMBINE
+// Program the records staged by write combining, e.g. before sleeping
+uint8_t EEPROM_flushCombined(void);
+
+// Program them once they are EEPROM_COMBINE_MS old; call it from the main
+// loop, otherwise only the next save checks their age
+uint8_t EEPROM_serviceCombined(void);
+#endif
+
+// In dry-run mode saves count flash operations without performing them
+void EEPROM_setDryRun(uint8_t enable);
+
+// Commit an update script (see EEPROM_layout.h) as one batch
+uint8_t EEPROM_applyUpdate(const uint8_t* script, uint16_t length);
+
+// Erase what EEPROM_clear left behind and, with a cold tier, move
+// variables that turned cold there now, e.g. from the idle loop
+uint8_t EEPROM_maintain(void);
+
+#if EEPROM_COLD_EXTERNAL
+// Mount the external device holding the cold tier, before the first save
+// or read
+uint8_t EEPROM_setColdDevice(EEPROM_ExtDevice* dev);
+#endif
+
+#if EEPROM_ISR_CACHE
+// Mirror a key in a RAM cache that interrupts can read; call from the main
+// loop. Saves, deletes and formats keep the cache current.
+uint8_t EEPROM_cacheKey(uint16_t key);
+
+// Read a cached key without touching flash, safe from any interrupt while
+// the main loop saves. Returns 0xFFFF when it is not stored or not cached.
+uint16_t EEPROM_readCached(uint16_t key);
+
+// Read cached keys key (low half) and key + 1 (high half), saved together
+// by one EEPROM_saveKeys call, as one 32-bit value that is never torn
+uint32_t EEPROM_readCached32(uint16_t key);
+#endif
+
+#if EEPROM_CRASH_PAGE
+// Store up to EEPROM_CRASH_WORDS words (registers, event codes) from a
+// fault handler: runs from RAM with interrupts masked (their state is
+// restored on return), never erases and programs at most
+// EEPROM_CRASH_BLOCKS blocks. Fails when no erased slot is left.
+uint8_t EEPROM_crashSave(const uint32_t* words, uint8_t count);
+
+// Copy the newest snapshot; returns its word count, 0 when there is none.
+// EEPROM_maintain erases the crash page once it has been read.
+uint8_t EEPROM_crashRead(uint32_t* words);
+#endif
+
+#if EEPROM_LOG_PAGES
+// Streaming logger statistics
+typedef struct {
+    uint32_t bytes;      // Bytes accepted by EEPROM_logWrite
+    uint32_t blocks;     // Blocks programmed
+    uint32_t erases;     // Pages erased ahead of the stream
+    uint32_t overruns;   // Writes cut short because both buffers were full
+    uint32_t dropped;    // Bytes lost to overruns
+    uint32_t busyTicks;  // EEPROM_TICKS() spent programming and erasing
+} EEPROM_LogStats;
+
+// Mount the log: find its end and erase the page ahead of it. With clear
+// set, every log page is erased first.
+uint8_t EEPROM_logInit(uint8_t clear);
+
+// Append bytes to the RAM buffer being filled (safe from one ISR). Returns
+// EEPROM_ERROR when bytes were dropped because the other buffer was still
+// waiting for EEPROM_logService.
+uint8_t EEPROM_logWrite(const void* data, uint16_t len);
+
+// Program a filled buffer, e.g. from the main loop
+uint8_t EEPROM_logService(void);
+
+// Pad the buffer being filled with 0xFF and program it, e.g. after a burst
+uint8_t EEPROM_logFlush(void);
+
+// Copy up to len stored bytes starting at pos (0 is the oldest byte). The
+// 0xFF bytes that EEPROM_logFlush padded a block with are returned as data.
+uint32_t EEPROM_logRead(uint32_t pos, uint8_t* out, uint32_t len);
+
+void EEPROM_logGetStats(EEPROM_LogStats* stats);
+void EEPROM_logResetStats(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* EEPROM_H */
@@ -0,0 +1,80 @@
+/******************************************************************************
+ * EEPROM_24cxx.c - 24Cxx I2C EEPROM driver for the external backend
+ *
+ * Parts up to 2KB (24C01..24C16) take one address byte and carry the upper
+ * address bits in the device address; larger parts take two address bytes.
+ * The end of a write cycle is detected by ACK polling.
+ ******************************************************************************/
+
+#include "EEPROM_ext.h"
+
+#include <stddef.h>
+
+// Build the address bytes and device address for a memory address
+static uint8_t EEPROM_24cxxAddress(EEPROM_ExtDevice* dev, uint32_t addr,
+                                   uint8_t* head) {
+    if (dev->addrBytes == 2) {
+        head[0] = (uint8_t)(addr >> 8);
+        head[1] = (uint8_t)addr;
+        return dev->busAddr;
+    }
+
+    head[0] = (uint8_t)addr;
+    return (uint8_t)(dev->busAddr | ((addr >> 8) & 0x07));
+}
+
+// Wait for the internal write cycle to finish (device ACKs again)
+static uint8_t EEPROM_24cxxWait(EEPROM_ExtDevice* dev, uint8_t addr7) {
+    const EEPROM_I2CBus* bus = (const EEPROM_I2CBus*)dev->bus;
+
+    for (uint32_t i = 0; i < EEPROM_EXT_POLL_LIMIT; i++) {
+        if (bus->write(bus->ctx, addr7, NULL, 0, NULL, 0) == EEPROM_OK) {
+            return EEPROM_OK;
+        }
+        dev->stats.polls++;
+    }
+
+    return EEPROM_ERROR;
+}
+
+static uint8_t EEPROM_24cxxRead(EEPROM_ExtDevice* dev, uint32_t addr,
+                                uint8_t* data, uint16_t len) {
+    const EEPROM_I2CBus* bus = (const EEPROM_I2CBus*)dev->bus;
+    uint8_t head[2];
+    uint8_t addr7 = EEPROM_24cxxAddress(dev, addr, head);
+
+    return bus->read(bus->ctx, addr7, head, dev->addrBytes, data, len);
+}
+
+static uint8_t EEPROM_24cxxWrite(EEPROM_ExtDevice* dev, uint32_t addr,
+                                 const uint8_t* data, uint16_t len) {
+    const EEPROM_I2CBus* bus = (const EEPROM_I2CBus*)dev->bus;
+    uint8_t head[2];
+    uint8_t addr7 = EEPROM_24cxxAddress(dev, addr, head);
+
+    if (bus->write(bus->ctx, addr7, head, dev->addrBytes, data, len) !=
+        EEPROM_OK) {
+        return EEPROM_ERROR;
+    }
+
+    return EEPROM_24cxxWait(dev, addr7);
+}
+
+// Set up a device using the whole EEPROM (byte-writable, never erased)
+void EEPROM_24cxxInit(EEPROM_ExtDevice* dev, const EEPROM_I2CBus* bus,
+                      uint8_t addr7, uint32_t size, uint16_t pageSize) {
+    dev->read = EEPROM_24cxxRead;
+    dev->write = EEPROM_24cxxWrite;
+    dev->erase = NULL;
+    dev->bus = bus;
+    dev->busAddr = addr7;
+    dev->addrBytes = size > 2048 ? 2 : 1;
+
+    dev->base = 0;
+    dev->size = size;
+    dev->pageSize = pageSize;
+    dev->sectorSize = 0;
+
+    dev->end = 0;
+    dev->stats = (EEPROM_ExtStats){0, 0, 0, 0, 0};
+}
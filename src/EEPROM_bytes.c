@@ -0,0 +1,197 @@
+/******************************************************************************
+ * EEPROM_bytes.c - Byte-addressable virtual EEPROM on top of the store
+ ******************************************************************************/
+
+#include "EEPROM_bytes.h"
+
+#include <stddef.h>
+
+#include "EEPROM.h"
+
+#if EEPROM_BYTES
+
+#if (EEPROM_BYTES_SIZE & 1) || (EEPROM_BYTES_PAGE & 1)
+#error "EEPROM_BYTES_SIZE and EEPROM_BYTES_PAGE must be even"
+#endif
+
+#if EEPROM_BYTES_PAGE < 2 || EEPROM_BYTES_PAGE > 64
+#error "EEPROM_BYTES_PAGE must be between 2 and 64"
+#endif
+
+#if EEPROM_BYTES_CACHE < 1 || EEPROM_BYTES_CACHE * EEPROM_BYTES_PAGE / 2 > 255
+#error "EEPROM_BYTES_CACHE pages must hold 1 to 255 byte pairs"
+#endif
+
+#if EEPROM_BYTES_KEY + EEPROM_BYTES_SIZE / 2 > EEPROM_KEY_CLEAR
+#error "The virtual EEPROM keys run into the reserved keys"
+#endif
+
+// The byte pairs are spread evenly over the shards
+#if (EEPROM_BYTES_SIZE / 2 + EEPROM_SHARDS - 1) / EEPROM_SHARDS > \
+    EEPROM_MAX_VARS
+#error "EEPROM_BYTES_SIZE does not fit, raise EEPROM_MAX_VARS or EEPROM_SHARDS"
+#endif
+
+#define EEPROM_BYTES_PAIRS (EEPROM_BYTES_PAGE / 2)
+#define EEPROM_BYTES_NO_PAGE 0xFFFF
+
+// One virtual page held in RAM
+typedef struct {
+    uint16_t page;                     // Virtual page, or NO_PAGE
+    uint32_t dirty;                    // Byte pairs changed since the commit
+    uint8_t data[EEPROM_BYTES_PAGE];
+} EEPROM_BytesSlot;
+
+static EEPROM_BytesSlot EEPROM_bytesSlots[EEPROM_BYTES_CACHE];
+static uint8_t EEPROM_bytesMounted = 0;
+static uint8_t EEPROM_bytesNext = 0;  // Next slot to replace
+static uint16_t EEPROM_bytesResets;   // EEPROM_resetCount of the slots
+
+// Empty the cache at first use and after the store was formatted or
+// cleared, which voids uncommitted writes as well
+static void EEPROM_bytesMount(void) {
+    uint16_t resets = EEPROM_resetCount();
+
+    if (EEPROM_bytesMounted && EEPROM_bytesResets == resets) return;
+
+    for (uint8_t i = 0; i < EEPROM_BYTES_CACHE; i++) {
+        EEPROM_bytesSlots[i].page = EEPROM_BYTES_NO_PAGE;
+        EEPROM_bytesSlots[i].dirty = 0;
+    }
+    EEPROM_bytesMounted = 1;
+    EEPROM_bytesResets = resets;
+}
+
+// Find the cached copy of a virtual page
+static EEPROM_BytesSlot* EEPROM_bytesFind(uint16_t page) {
+    EEPROM_bytesMount();
+
+    for (uint8_t i = 0; i < EEPROM_BYTES_CACHE; i++) {
+        if (EEPROM_bytesSlots[i].page == page) return &EEPROM_bytesSlots[i];
+    }
+
+    return NULL;
+}
+
+// Cache a virtual page, replacing a clean one when possible. When every
+// slot is dirty they are all committed first, as one batch.
+static EEPROM_BytesSlot* EEPROM_bytesLoad(uint16_t page) {
+    EEPROM_BytesSlot* slot = EEPROM_bytesFind(page);
+    if (slot) return slot;
+
+    for (uint8_t i = 0; i < EEPROM_BYTES_CACHE; i++) {
+        if (!EEPROM_bytesSlots[i].dirty) {
+            slot = &EEPROM_bytesSlots[i];
+            break;
+        }
+    }
+
+    if (!slot) {
+        if (EEPROM_bytesCommit() != EEPROM_OK) return NULL;
+
+        slot = &EEPROM_bytesSlots[EEPROM_bytesNext];
+        EEPROM_bytesNext = (EEPROM_bytesNext + 1) % EEPROM_BYTES_CACHE;
+    }
+
+    // Pairs never saved read as 0xFFFF, like erased EEPROM
+    uint16_t key = EEPROM_BYTES_KEY + page * EEPROM_BYTES_PAIRS;
+
+    for (uint8_t j = 0; j < EEPROM_BYTES_PAIRS; j++) {
+        uint16_t value = EEPROM_readKey(key + j);
+
+        slot->data[2 * j] = (uint8_t)value;
+        slot->data[2 * j + 1] = (uint8_t)(value >> 8);
+    }
+
+    slot->page = page;
+    slot->dirty = 0;
+    return slot;
+}
+
+uint8_t EEPROM_byteRead(uint16_t addr) {
+    if (addr >= EEPROM_BYTES_SIZE) return 0xFF;
+
+    EEPROM_BytesSlot* slot = EEPROM_bytesFind(addr / EEPROM_BYTES_PAGE);
+    if (slot) return slot->data[addr % EEPROM_BYTES_PAGE];
+
+    // Reads of uncached pages do not evict anything
+    uint16_t value = EEPROM_readKey(EEPROM_BYTES_KEY + addr / 2);
+    return (addr & 1) ? (uint8_t)(value >> 8) : (uint8_t)value;
+}
+
+uint8_t EEPROM_byteWrite(uint16_t addr, uint8_t value) {
+    if (addr >= EEPROM_BYTES_SIZE) return EEPROM_ERROR;
+
+    EEPROM_BytesSlot* slot = EEPROM_bytesLoad(addr / EEPROM_BYTES_PAGE);
+    if (!slot) return EEPROM_ERROR;
+
+    uint8_t offset = addr % EEPROM_BYTES_PAGE;
+
+    if (slot->data[offset] != value) {
+        slot->data[offset] = value;
+        slot->dirty |= (uint32_t)1 << (offset / 2);
+    }
+
+    return EEPROM_OK;
+}
+
+uint8_t EEPROM_bytesGet(uint16_t addr, void* data, uint16_t len) {
+    uint8_t* out = (uint8_t*)data;
+
+    if ((uint32_t)addr + len > EEPROM_BYTES_SIZE) return EEPROM_ERROR;
+
+    for (uint16_t i = 0; i < len; i++) out[i] = EEPROM_byteRead(addr + i);
+    return EEPROM_OK;
+}
+
+uint8_t EEPROM_bytesPut(uint16_t addr, const void* data, uint16_t len) {
+    const uint8_t* in = (const uint8_t*)data;
+
+    if ((uint32_t)addr + len > EEPROM_BYTES_SIZE) return EEPROM_ERROR;
+
+    // Start from clean slots so the new bytes go out in one batch
+    uint8_t status = EEPROM_bytesCommit();
+    if (status != EEPROM_OK) return status;
+
+    for (uint16_t i = 0; i < len; i++) {
+        status = EEPROM_byteWrite(addr + i, in[i]);
+        if (status != EEPROM_OK) return status;
+    }
+
+    return EEPROM_bytesCommit();
+}
+
+uint8_t EEPROM_bytesCommit(void) {
+    uint16_t keys[EEPROM_BYTES_CACHE * EEPROM_BYTES_PAIRS];
+    uint16_t values[EEPROM_BYTES_CACHE * EEPROM_BYTES_PAIRS];
+    uint8_t count = 0;
+
+    EEPROM_bytesMount();
+
+    for (uint8_t i = 0; i < EEPROM_BYTES_CACHE; i++) {
+        EEPROM_BytesSlot* slot = &EEPROM_bytesSlots[i];
+        uint16_t key = EEPROM_BYTES_KEY + slot->page * EEPROM_BYTES_PAIRS;
+
+        for (uint8_t j = 0; j < EEPROM_BYTES_PAIRS; j++) {
+            if (!(slot->dirty & ((uint32_t)1 << j))) continue;
+
+            keys[count] = key + j;
+            values[count] = slot->data[2 * j] |
+                            (uint16_t)(slot->data[2 * j + 1] << 8);
+            count++;
+        }
+    }
+
+    if (count == 0) return EEPROM_OK;
+
+    uint8_t status = EEPROM_saveKeys(keys, values, count);
+    if (status != EEPROM_OK) return status;
+
+    for (uint8_t i = 0; i < EEPROM_BYTES_CACHE; i++) {
+        EEPROM_bytesSlots[i].dirty = 0;
+    }
+
+    return EEPROM_OK;
+}
+
+#endif /* EEPROM_BYTES */
@@ -0,0 +1,107 @@
+/******************************************************************************
+ * EEPROM_bytes.h - Byte-addressable virtual EEPROM on top of the store
+ *
+ * For code ported from boards with a real EEPROM: a virtual array of
+ * EEPROM_BYTES_SIZE bytes with read/write and put/get, built when
+ * EEPROM_BYTES is set to 1. Every aligned pair of bytes is stored as one
+ * 16-bit key, starting at EEPROM_BYTES_KEY, so the store needs room for
+ * EEPROM_BYTES_SIZE / 2 extra keys (raise EEPROM_MAX_VARS or EEPROM_SHARDS
+ * for more than the default 16 bytes). Bytes never written read as 0xFF.
+ *
+ * Writes land in RAM copies of EEPROM_BYTES_PAGE-byte virtual pages. Only
+ * the byte pairs that changed are saved, all in one EEPROM_saveKeys batch,
+ * when EEPROM_bytesCommit is called or a dirty page is evicted.
+ * EEPROM_format and EEPROM_clear void the cached pages, uncommitted writes
+ * included.
+ ******************************************************************************/
+
+#ifndef EEPROM_BYTES_H
+#define EEPROM_BYTES_H
+
+#include <stdint.h>
+
+#include "EEPROM_layout.h"
+
+// Set to 1 to build the virtual EEPROM (EEPROM_bytes.c)
+#ifndef EEPROM_BYTES
+#define EEPROM_BYTES 0
+#endif
+
+// Size of the virtual array in bytes (even). The default takes 8 of the 10
+// keys of the default store.
+#ifndef EEPROM_BYTES_SIZE
+#define EEPROM_BYTES_SIZE 16
+#endif
+
+// Key of the first byte pair
+#ifndef EEPROM_BYTES_KEY
+#define EEPROM_BYTES_KEY 0x8000
+#endif
+
+// Bytes per virtual page cached in RAM (even, at most 64)
+#ifndef EEPROM_BYTES_PAGE
+#define EEPROM_BYTES_PAGE 8
+#endif
+
+// Virtual pages cached in RAM
+#ifndef EEPROM_BYTES_CACHE
+#define EEPROM_BYTES_CACHE 2
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Read a byte; returns 0xFF for bytes never written or out of range
+uint8_t EEPROM_byteRead(uint16_t addr);
+
+// Write a byte to its cached page; nothing reaches flash until the page is
+// committed
+uint8_t EEPROM_byteWrite(uint16_t addr, uint8_t value);
+
+// Copy len bytes starting at addr
+uint8_t EEPROM_bytesGet(uint16_t addr, void* data, uint16_t len);
+
+// Write len bytes starting at addr and commit them. Up to
+// (EEPROM_BYTES_CACHE - 1) * EEPROM_BYTES_PAGE bytes are saved by a
+// single EEPROM_saveKeys call. That call commits EEPROM_BATCH_MAX pairs at
+// a time, so a put that changes more pairs is not atomic: a reset during
+// it can leave the range partly written.
+uint8_t EEPROM_bytesPut(uint16_t addr, const void* data, uint16_t len);
+
+// Save every changed byte pair of the cached pages with one
+// EEPROM_saveKeys call
+uint8_t EEPROM_bytesCommit(void);
+
+#ifdef __cplusplus
+}
+
+// Arduino-style access, e.g. EEPROM_Bytes EEPROM; EEPROM.put(0, config);
+struct EEPROM_Bytes {
+    uint8_t read(uint16_t addr) { return EEPROM_byteRead(addr); }
+    uint8_t write(uint16_t addr, uint8_t value) {
+        return EEPROM_byteWrite(addr, value);
+    }
+    uint8_t update(uint16_t addr, uint8_t value) {
+        return EEPROM_byteWrite(addr, value);
+    }
+    uint8_t commit() { return EEPROM_bytesCommit(); }
+    uint16_t length() { return EEPROM_BYTES_SIZE; }
+
+    // The whole object is saved by one commit, atomic up to
+    // EEPROM_BATCH_MAX changed byte pairs (see EEPROM_bytesPut)
+    template <typename T>
+    const T& put(uint16_t addr, const T& value) {
+        EEPROM_bytesPut(addr, &value, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    T& get(uint16_t addr, T& value) {
+        EEPROM_bytesGet(addr, &value, sizeof(T));
+        return value;
+    }
+};
+#endif
+
+#endif /* EEPROM_BYTES_H */
@@ -0,0 +1,575 @@
+/******************************************************************************
+ * EEPROM_ext.c - External memory backends for the EEPROM library
+ *
+ * Record log engine for external devices (see EEPROM_ext.h).
+ ******************************************************************************/
+
+#include "EEPROM_ext.h"
+
+#include <stddef.h>
+
+#ifdef EEPROM_EXT_API
+#include "EEPROM.h"
+#endif
+
+// Records read per device transaction while scanning
+#define EEPROM_EXT_SCAN_RECORDS (EEPROM_EXT_BUFFER / EEPROM_RECORD_SIZE)
+
+#if EEPROM_EXT_SCAN_RECORDS < 1
+#error "EEPROM_EXT_BUFFER must hold at least one record"
+#endif
+
+static uint16_t EEPROM_extGet16(const uint8_t* data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static void EEPROM_extPut16(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+// Check the CRC of a record held in RAM
+static uint8_t EEPROM_extRecordValid(const uint8_t* record) {
+    return EEPROM_extGet16(record + 4) ==
+           EEPROM_calcCRC(EEPROM_extGet16(record), EEPROM_extGet16(record + 2));
+}
+
+// Check if a record held in RAM is a tombstone
+static uint8_t EEPROM_extTombstone(const uint8_t* record) {
+    return EEPROM_extGet16(record + 2) == EEPROM_TOMBSTONE_VALUE &&
+           EEPROM_extGet16(record + 4) ==
+               EEPROM_tombstoneCRC(EEPROM_extGet16(record));
+}
+
+// Write data to the log, split at device page boundaries
+static uint8_t EEPROM_extProgram(EEPROM_ExtDevice* dev, uint32_t offset,
+                                 const uint8_t* data, uint16_t len) {
+    while (len > 0) {
+        uint32_t addr = dev->base + offset;
+        uint16_t chunk = (uint16_t)(dev->pageSize - addr % dev->pageSize);
+        if (chunk > len) chunk = len;
+
+        uint8_t status = dev->write(dev, addr, data, chunk);
+        if (status != EEPROM_OK) return status;
+
+        dev->stats.writes++;
+        dev->stats.bytesWritten += chunk;
+        offset += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+
+    return EEPROM_OK;
+}
+
+// Bytes staged for writing the log in order
+typedef struct {
+    EEPROM_ExtDevice* dev;
+    uint32_t offset;  // Log offset of data[0]
+    uint16_t len;
+    uint8_t data[EEPROM_EXT_BUFFER];
+} EEPROM_ExtWriter;
+
+static uint8_t EEPROM_extFlush(EEPROM_ExtWriter* w) {
+    uint8_t status = EEPROM_extProgram(w->dev, w->offset, w->data, w->len);
+
+    w->offset += w->len;
+    w->len = 0;
+    return status;
+}
+
+// Stage a half-word, writing out whenever the buffer or a page is full
+static uint8_t EEPROM_extPut(EEPROM_ExtWriter* w, uint16_t value) {
+    EEPROM_extPut16(w->data + w->len, value);
+    w->len += 2;
+
+    uint32_t next = w->dev->base + w->offset + w->len;
+    if (w->len + 2 > EEPROM_EXT_BUFFER || next % w->dev->pageSize == 0) {
+        return EEPROM_extFlush(w);
+    }
+
+    return EEPROM_OK;
+}
+
+// Erase the storage area, or write an empty log on byte-writable devices
+uint8_t EEPROM_extFormat(EEPROM_ExtDevice* dev) {
+    EEPROM_ExtWriter w;
+    uint8_t status;
+
+    dev->end = 0;
+
+    if (dev->erase) {
+        for (uint32_t offset = 0; offset < dev->size;
+             offset += dev->sectorSize) {
+            status = dev->erase(dev, dev->base + offset);
+            if (status != EEPROM_OK) return status;
+            dev->stats.erases++;
+        }
+    }
+
+    w.dev = dev;
+    w.offset = 0;
+    w.len = 0;
+
+    status = EEPROM_extPut(&w, EEPROM_MARKER);
+    if (status == EEPROM_OK) status = EEPROM_extPut(&w, EEPROM_SUMMARY_NONE);
+    if (status == EEPROM_OK && !dev->erase) {
+        status = EEPROM_extPut(&w, 0xFFFF);
+    }
+    if (status == EEPROM_OK && w.len) status = EEPROM_extFlush(&w);
+    if (status != EEPROM_OK) return status;
+
+    dev->end = EEPROM_HEADER_SIZE;
+    return EEPROM_OK;
+}
+
+// Mount the log: check the marker and find the first free record slot
+uint8_t EEPROM_extInit(EEPROM_ExtDevice* dev) {
+    uint8_t data[EEPROM_EXT_SCAN_RECORDS * EEPROM_RECORD_SIZE];
+    uint32_t offset = EEPROM_HEADER_SIZE;
+
+    dev->end = 0;
+
+    uint8_t status = dev->read(dev, dev->base, data, 2);
+    if (status != EEPROM_OK) return status;
+    if (EEPROM_extGet16(data) != EEPROM_MARKER) return EEPROM_OK;
+
+    while (offset + EEPROM_RECORD_SIZE <= dev->size) {
+        uint32_t len = dev->size - offset;
+        if (len > sizeof(data)) len = sizeof(data);
+        len -= len % EEPROM_RECORD_SIZE;
+
+        status = dev->read(dev, dev->base + offset, data, (uint16_t)len);
+        if (status != EEPROM_OK) return status;
+
+        for (uint32_t i = 0; i < len; i += EEPROM_RECORD_SIZE) {
+            // Check for end of data (empty slot or terminator)
+            if (EEPROM_extGet16(data + i) == 0xFFFF) {
+                dev->end = offset + i;
+                return EEPROM_OK;
+            }
+        }
+        offset += len;
+    }
+
+    dev->end = offset;
+    return EEPROM_OK;
+}
+
+// Walk the log and report the newest record of a variable. With out and n
+// set, collect up to n values newest first instead. A tombstone hides the
+// records before it.
+static uint8_t EEPROM_extFind(EEPROM_ExtDevice* dev, uint16_t id,
+                              uint16_t* value, uint16_t* out, uint8_t n) {
+    uint8_t data[EEPROM_EXT_SCAN_RECORDS * EEPROM_RECORD_SIZE];
+    uint32_t offset = dev->end;
+    uint8_t found = 0;
+
+    if (dev->end == 0) return 0;
+
+    // Walk backwards, the first match is the newest record
+    while (offset > EEPROM_HEADER_SIZE) {
+        uint32_t len = offset - EEPROM_HEADER_SIZE;
+        if (len > sizeof(data)) len = sizeof(data);
+        offset -= len;
+
+        if (dev->read(dev, dev->base + offset, data, (uint16_t)len) !=
+            EEPROM_OK) {
+            return found;
+        }
+
+        for (uint32_t i = len; i > 0; i -= EEPROM_RECORD_SIZE) {
+            const uint8_t* record = data + i - EEPROM_RECORD_SIZE;
+
+            if (EEPROM_extGet16(record) != id) continue;
+            if (EEPROM_extTombstone(record)) return found;
+            if (!EEPROM_extRecordValid(record)) continue;
+
+            if (!out) {
+                *value = EEPROM_extGet16(record + 2);
+                return 1;
+            }
+            out[found++] = EEPROM_extGet16(record + 2);
+            if (found == n) return found;
+        }
+    }
+
+    return found;
+}
+
+// Retained versions of one variable, oldest first
+typedef struct {
+    uint16_t id;
+    uint8_t count;
+    uint16_t values[EEPROM_HISTORY_KEEP];
+} EEPROM_ExtVar;
+
+// Push a value into the retained versions of its variable
+static uint8_t EEPROM_extKeep(EEPROM_ExtVar* vars, uint8_t* varCount,
+                              uint16_t id, uint16_t value) {
+    uint8_t i;
+
+    for (i = 0; i < *varCount; i++) {
+        if (vars[i].id == id) break;
+    }
+
+    if (i == *varCount) {
+        if (*varCount >= EEPROM_EXT_MAX_VARS) return EEPROM_ERROR;
+        vars[i].id = id;
+        vars[i].count = 0;
+        (*varCount)++;
+    }
+
+    // Drop the oldest version once K versions are held
+    if (vars[i].count == EEPROM_HISTORY_KEEP) {
+        for (uint8_t k = 1; k < EEPROM_HISTORY_KEEP; k++) {
+            vars[i].values[k - 1] = vars[i].values[k];
+        }
+        vars[i].count--;
+    }
+
+    vars[i].values[vars[i].count++] = value;
+    return EEPROM_OK;
+}
+
+// Forget the retained versions of a deleted variable
+static void EEPROM_extDrop(EEPROM_ExtVar* vars, uint8_t* varCount,
+                           uint16_t id) {
+    for (uint8_t i = 0; i < *varCount; i++) {
+        if (vars[i].id == id) {
+            vars[i] = vars[--(*varCount)];
+            return;
+        }
+    }
+}
+
+// Compact the log: keep the newest versions of every variable, apply the
+// new values (or deletes, with mask set) and write the log again from the
+// start. Deleted variables leave nothing behind.
+static uint8_t EEPROM_extCompact(EEPROM_ExtDevice* dev, const uint16_t* ids,
+                                 const uint16_t* values, uint8_t count,
+                                 uint16_t mask) {
+    uint8_t data[EEPROM_EXT_SCAN_RECORDS * EEPROM_RECORD_SIZE];
+    EEPROM_ExtVar vars[EEPROM_EXT_MAX_VARS];
+    uint8_t varCount = 0;
+    uint8_t status;
+
+    // Read all existing records, oldest first
+    for (uint32_t offset = EEPROM_HEADER_SIZE; offset < dev->end;) {
+        uint32_t len = dev->end - offset;
+        if (len > sizeof(data)) len = sizeof(data);
+
+        status = dev->read(dev, dev->base + offset, data, (uint16_t)len);
+        if (status != EEPROM_OK) return status;
+
+        for (uint32_t i = 0; i < len; i += EEPROM_RECORD_SIZE) {
+            if (EEPROM_extTombstone(data + i)) {
+                EEPROM_extDrop(vars, &varCount, EEPROM_extGet16(data + i));
+                continue;
+            }
+            if (!EEPROM_extRecordValid(data + i)) continue;
+
+            status = EEPROM_extKeep(vars, &varCount,
+                                    EEPROM_extGet16(data + i),
+                                    EEPROM_extGet16(data + i + 2));
+            if (status != EEPROM_OK) return status;
+        }
+        offset += len;
+    }
+
+    // Add our new values
+    for (uint8_t j = 0; j < count; j++) {
+        if (mask) {
+            EEPROM_extDrop(vars, &varCount, ids[j]);
+            continue;
+        }
+
+        status = EEPROM_extKeep(vars, &varCount, ids[j], values[j]);
+        if (status != EEPROM_OK) return status;
+    }
+
+    // Erase (if the device needs it) and write the header
+    status = EEPROM_extFormat(dev);
+    if (status != EEPROM_OK) return status;
+
+    // Write each variable, oldest version first. Byte-writable devices get
+    // the terminator after the last record.
+    EEPROM_ExtWriter w;
+    uint32_t end = EEPROM_HEADER_SIZE;
+
+    w.dev = dev;
+    w.offset = EEPROM_HEADER_SIZE;
+    w.len = 0;
+
+    for (uint8_t i = 0; i < varCount && status == EEPROM_OK; i++) {
+        for (uint8_t k = 0; k < vars[i].count && status == EEPROM_OK; k++) {
+            uint16_t id = vars[i].id;
+            uint16_t value = vars[i].values[k];
+
+            status = EEPROM_extPut(&w, id);
+            if (status == EEPROM_OK) status = EEPROM_extPut(&w, value);
+            if (status == EEPROM_OK) {
+                status = EEPROM_extPut(&w, EEPROM_calcCRC(id, value));
+            }
+            end += EEPROM_RECORD_SIZE;
+        }
+    }
+    if (status == EEPROM_OK && !dev->erase) status = EEPROM_extPut(&w, 0xFFFF);
+    if (status == EEPROM_OK && w.len) status = EEPROM_extFlush(&w);
+
+    // A log cut short is left unformatted: the next save compacts again
+    // instead of appending after records that may not have been written
+    dev->end = status == EEPROM_OK ? end : 0;
+    return status;
+}
+
+// Byte k of an appended batch: its records, then the terminator. The CRC
+// of every record is inverted by mask (EEPROM_TOMBSTONE_MASK for deletes).
+static uint8_t EEPROM_extBatchByte(const uint16_t* ids, const uint16_t* values,
+                                   uint8_t count, uint16_t mask, uint32_t k) {
+    uint32_t r = k / EEPROM_RECORD_SIZE;
+    uint8_t i = (uint8_t)(k % EEPROM_RECORD_SIZE);
+    uint16_t half;
+
+    if (r >= count) {
+        half = 0xFFFF;
+    } else if (i < 2) {
+        half = ids[r];
+    } else if (i < 4) {
+        half = values[r];
+    } else {
+        half = EEPROM_calcCRC(ids[r], values[r]) ^ mask;
+    }
+
+    return (i & 1) ? (uint8_t)(half >> 8) : (uint8_t)half;
+}
+
+// Program bytes [from, to) of an appended batch at the end of the log, in
+// order, each transaction staying within one device page
+static uint8_t EEPROM_extAppendRange(EEPROM_ExtDevice* dev,
+                                     const uint16_t* ids,
+                                     const uint16_t* values, uint8_t count,
+                                     uint16_t mask, uint32_t from,
+                                     uint32_t to) {
+    uint8_t data[EEPROM_EXT_BUFFER];
+
+    while (from < to) {
+        uint32_t addr = dev->base + dev->end + from;
+        uint32_t len = dev->pageSize - addr % dev->pageSize;
+
+        if (len > EEPROM_EXT_BUFFER) len = EEPROM_EXT_BUFFER;
+        if (len > to - from) len = to - from;
+
+        for (uint32_t k = 0; k < len; k++) {
+            data[k] =
+                EEPROM_extBatchByte(ids, values, count, mask, from + k);
+        }
+
+        uint8_t status =
+            EEPROM_extProgram(dev, dev->end + from, data, (uint16_t)len);
+        if (status != EEPROM_OK) return status;
+
+        from += len;
+    }
+
+    return EEPROM_OK;
+}
+
+// Append a batch of records in order, as the internal log does: a torn
+// record fails its CRC, and on erasable devices the next append still goes
+// to erased slots after it. On byte-writable devices a batch that takes
+// more than one page write has the ID half-word that replaces the old
+// terminator written last, after the records and the new terminator, so an
+// interrupted batch stays invisible.
+static uint8_t EEPROM_extAppend(EEPROM_ExtDevice* dev, const uint16_t* ids,
+                                const uint16_t* values, uint8_t count,
+                                uint16_t mask) {
+    uint32_t total = (uint32_t)count * EEPROM_RECORD_SIZE;
+    uint32_t addr = dev->base + dev->end;
+    uint32_t first = 0;
+    uint8_t status;
+
+    // Byte-writable devices need a terminator after the new records
+    if (!dev->erase) {
+        total += 2;
+        if (total > EEPROM_EXT_BUFFER ||
+            addr % dev->pageSize + total > dev->pageSize) {
+            first = 2;
+        }
+    }
+
+    status =
+        EEPROM_extAppendRange(dev, ids, values, count, mask, first, total);
+    if (status == EEPROM_OK && first) {
+        status = EEPROM_extAppendRange(dev, ids, values, count, mask, 0, first);
+    }
+    if (status != EEPROM_OK) return status;
+
+    dev->end += (uint32_t)count * EEPROM_RECORD_SIZE;
+    return EEPROM_OK;
+}
+
+// Write a batch of records (tombstones with mask set)
+static uint8_t EEPROM_extWrite(EEPROM_ExtDevice* dev, const uint16_t* ids,
+                               const uint16_t* values, uint8_t count,
+                               uint16_t mask) {
+    uint32_t need = (uint32_t)count * EEPROM_RECORD_SIZE;
+
+    if (!dev->erase) need += 2;
+
+    // Append when the whole batch fits, older records stay as history
+    if (dev->end != 0 && dev->end + need <= dev->size) {
+        return EEPROM_extAppend(dev, ids, values, count, mask);
+    }
+
+    // Log is full or not formatted yet
+    return EEPROM_extCompact(dev, ids, values, count, mask);
+}
+
+// Save multiple variables at once
+uint8_t EEPROM_extSaveVars(EEPROM_ExtDevice* dev, const uint16_t* ids,
+                           const uint16_t* values, uint8_t count) {
+    dev->stats.saves += count;
+
+    return EEPROM_extWrite(dev, ids, values, count, 0);
+}
+
+// Save a variable
+uint8_t EEPROM_extSaveVar(EEPROM_ExtDevice* dev, uint16_t id, uint16_t value) {
+    return EEPROM_extSaveVars(dev, &id, &value, 1);
+}
+
+// Read a variable by ID
+uint16_t EEPROM_extReadVar(EEPROM_ExtDevice* dev, uint16_t id) {
+    uint16_t value;
+
+    if (EEPROM_extFind(dev, id, &value, NULL, 0)) {
+        return value;
+    }
+
+    return 0xFFFF;  // Not found/invalid
+}
+
+// Check if variable exists
+uint8_t EEPROM_extVarExists(EEPROM_ExtDevice* dev, uint16_t id) {
+    uint16_t value;
+
+    return EEPROM_extFind(dev, id, &value, NULL, 0);
+}
+
+// Delete a variable: append a tombstone, or drop it while compacting
+uint8_t EEPROM_extDeleteVar(EEPROM_ExtDevice* dev, uint16_t id) {
+    uint16_t value = EEPROM_TOMBSTONE_VALUE;
+
+    // Nothing stored, nothing to hide
+    if (!EEPROM_extVarExists(dev, id)) return EEPROM_OK;
+
+    return EEPROM_extWrite(dev, &id, &value, 1, EEPROM_TOMBSTONE_MASK);
+}
+
+// Read the last committed values of a variable, newest first
+uint8_t EEPROM_extReadHistory(EEPROM_ExtDevice* dev, uint16_t id,
+                              uint16_t* out, uint8_t n) {
+    if (n == 0) return 0;
+
+    return EEPROM_extFind(dev, id, NULL, out, n);
+}
+
+// Mark the key bucket of every variable with a valid record in a bitmap
+void EEPROM_extKeyBitmap(EEPROM_ExtDevice* dev, uint8_t* bitmap) {
+    uint8_t data[EEPROM_EXT_SCAN_RECORDS * EEPROM_RECORD_SIZE];
+
+    for (uint32_t offset = EEPROM_HEADER_SIZE; offset < dev->end;) {
+        uint32_t len = dev->end - offset;
+        if (len > sizeof(data)) len = sizeof(data);
+
+        if (dev->read(dev, dev->base + offset, data, (uint16_t)len) !=
+            EEPROM_OK) {
+            return;
+        }
+
+        for (uint32_t i = 0; i < len; i += EEPROM_RECORD_SIZE) {
+            if (!EEPROM_extRecordValid(data + i)) continue;
+
+            uint8_t bucket = EEPROM_KEY_BUCKET(EEPROM_extGet16(data + i));
+            bitmap[bucket >> 3] |= (uint8_t)(1 << (bucket & 7));
+        }
+        offset += len;
+    }
+}
+
+#ifdef EEPROM_EXT_API
+// The EEPROM.h core functions, routed to the selected device
+static EEPROM_ExtDevice* EEPROM_extDevice = NULL;
+
+void EEPROM_extSelect(EEPROM_ExtDevice* dev) { EEPROM_extDevice = dev; }
+
+void EEPROM_init(void) { EEPROM_extInit(EEPROM_extDevice); }
+
+uint8_t EEPROM_format(void) { return EEPROM_extFormat(EEPROM_extDevice); }
+
+// External logs keep no generations: formatting a 24Cxx only rewrites its
+// terminator, a NOR device erases the sectors in use
+uint8_t EEPROM_clear(void) { return EEPROM_extFormat(EEPROM_extDevice); }
+
+uint8_t EEPROM_saveKey(uint16_t key, uint16_t value) {
+    return EEPROM_extSaveVar(EEPROM_extDevice, key, value);
+}
+
+uint8_t EEPROM_saveKeys(uint16_t* keys, uint16_t* values, uint8_t count) {
+    return EEPROM_extSaveVars(EEPROM_extDevice, keys, values, count);
+}
+
+uint16_t EEPROM_readKey(uint16_t key) {
+    return EEPROM_extReadVar(EEPROM_extDevice, key);
+}
+
+// A tombstone of 0xFFFF would end the log of a byte-writable device
+uint8_t EEPROM_deleteKey(uint16_t key) {
+    if (key >= EEPROM_KEY_CLEAR) return EEPROM_ERROR;
+
+    return EEPROM_extDeleteVar(EEPROM_extDevice, key);
+}
+
+uint8_t EEPROM_keyExists(uint16_t key) {
+    return EEPROM_extVarExists(EEPROM_extDevice, key);
+}
+
+uint8_t EEPROM_readKeyHistory(uint16_t key, uint16_t* out, uint8_t n) {
+    return EEPROM_extReadHistory(EEPROM_extDevice, key, out, n);
+}
+
+uint8_t EEPROM_saveVar(uint8_t id, uint16_t value) {
+    return EEPROM_saveKey(id, value);
+}
+
+// Batches larger than EEPROM_BATCH_MAX go out in chunks of that size, as
+// they do on the internal store, to bound the stack used for the keys
+uint8_t EEPROM_saveVars(uint8_t* ids, uint16_t* values, uint8_t count) {
+    uint16_t keys[EEPROM_BATCH_MAX];
+
+    for (uint8_t first = 0; first < count;) {
+        uint8_t n = count - first;
+
+        if (n > EEPROM_BATCH_MAX) n = EEPROM_BATCH_MAX;
+        for (uint8_t i = 0; i < n; i++) keys[i] = ids[first + i];
+
+        uint8_t status = EEPROM_saveKeys(keys, values + first, n);
+        if (status != EEPROM_OK) return status;
+
+        first += n;
+    }
+
+    return EEPROM_OK;
+}
+
+uint16_t EEPROM_readVar(uint8_t id) { return EEPROM_readKey(id); }
+
+uint8_t EEPROM_varExists(uint8_t id) { return EEPROM_keyExists(id); }
+
+uint8_t EEPROM_deleteVar(uint8_t id) { return EEPROM_deleteKey(id); }
+
+uint8_t EEPROM_readHistory(uint8_t id, uint16_t* out, uint8_t n) {
+    return EEPROM_readKeyHistory(id, out, n);
+}
+#endif
@@ -0,0 +1,129 @@
+/******************************************************************************
+ * EEPROM_ext.h - External memory backends for the EEPROM library
+ *
+ * Keeps the EEPROM record log on a 24Cxx I2C EEPROM or a SPI NOR flash.
+ * The log uses the same header and record format as the internal flash
+ * (see EEPROM_layout.h). Writes are batched into the native page-write
+ * size of the device, completion is detected by ACK or status-register
+ * polling, and byte-writable EEPROMs are never erased: the end of their
+ * log is marked by a 0xFFFF terminator written with every append.
+ *
+ * This code has no dependency on ch32v003fun.h, so it also runs on the
+ * host against the device simulators in tools/sim.
+ ******************************************************************************/
+
+#ifndef EEPROM_EXT_H
+#define EEPROM_EXT_H
+
+#include <stdint.h>
+
+#include "EEPROM_layout.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum number of distinct variables on an external device
+#ifndef EEPROM_EXT_MAX_VARS
+#define EEPROM_EXT_MAX_VARS 32
+#endif
+
+// Bytes staged in RAM per device write
+#ifndef EEPROM_EXT_BUFFER
+#define EEPROM_EXT_BUFFER 64
+#endif
+
+// Status polls before a write or erase is considered failed
+#ifndef EEPROM_EXT_POLL_LIMIT
+#define EEPROM_EXT_POLL_LIMIT 100000
+#endif
+
+// I2C bus used by the 24Cxx driver. Both calls send head after the device
+// address; write then sends data, read issues a repeated start and reads
+// data. They return EEPROM_OK when the device acknowledged its address.
+typedef struct {
+    uint8_t (*write)(void* ctx, uint8_t addr7, const uint8_t* head,
+                     uint8_t headLen, const uint8_t* data, uint16_t len);
+    uint8_t (*read)(void* ctx, uint8_t addr7, const uint8_t* head,
+                    uint8_t headLen, uint8_t* data, uint16_t len);
+    void* ctx;
+} EEPROM_I2CBus;
+
+// SPI bus used by the SPI NOR driver. transfer sends 0xFF when tx is NULL
+// and discards the received bytes when rx is NULL.
+typedef struct {
+    void (*select)(void* ctx, uint8_t active);
+    void (*transfer)(void* ctx, const uint8_t* tx, uint8_t* rx,
+                     uint16_t len);
+    void* ctx;
+} EEPROM_SPIBus;
+
+// Device operation statistics
+typedef struct {
+    uint32_t saves;         // Values passed to the save functions
+    uint32_t writes;        // Page-write transactions
+    uint32_t bytesWritten;  // Bytes sent in page writes
+    uint32_t erases;        // Sector erases
+    uint32_t polls;         // Busy polls while waiting for the device
+} EEPROM_ExtStats;
+
+typedef struct EEPROM_ExtDevice EEPROM_ExtDevice;
+
+struct EEPROM_ExtDevice {
+    // Driver, set up by EEPROM_24cxxInit or EEPROM_spinorInit. Writes never
+    // cross a page boundary. erase is NULL for byte-writable devices.
+    uint8_t (*read)(EEPROM_ExtDevice* dev, uint32_t addr, uint8_t* data,
+                    uint16_t len);
+    uint8_t (*write)(EEPROM_ExtDevice* dev, uint32_t addr,
+                     const uint8_t* data, uint16_t len);
+    uint8_t (*erase)(EEPROM_ExtDevice* dev, uint32_t addr);
+    const void* bus;
+    uint8_t busAddr;    // I2C device address
+    uint8_t addrBytes;  // Memory address bytes sent per transaction
+
+    // Storage area inside the device
+    uint32_t base;        // Device address of the log
+    uint32_t size;        // Bytes used for the log
+    uint16_t pageSize;    // Native page-write size
+    uint32_t sectorSize;  // Erase unit (erasable devices only)
+
+    // Engine state
+    uint32_t end;  // Offset of the first free record slot, 0 if unformatted
+    EEPROM_ExtStats stats;
+};
+
+// Drivers
+void EEPROM_24cxxInit(EEPROM_ExtDevice* dev, const EEPROM_I2CBus* bus,
+                      uint8_t addr7, uint32_t size, uint16_t pageSize);
+void EEPROM_spinorInit(EEPROM_ExtDevice* dev, const EEPROM_SPIBus* bus,
+                       uint32_t base, uint32_t size);
+
+// Mount the log (finds the append position)
+uint8_t EEPROM_extInit(EEPROM_ExtDevice* dev);
+
+// Erase the log (byte-writable devices only get a new header)
+uint8_t EEPROM_extFormat(EEPROM_ExtDevice* dev);
+
+// Variable operations on 16-bit keys, as in EEPROM.h
+uint8_t EEPROM_extSaveVar(EEPROM_ExtDevice* dev, uint16_t id, uint16_t value);
+uint8_t EEPROM_extSaveVars(EEPROM_ExtDevice* dev, const uint16_t* ids,
+                           const uint16_t* values, uint8_t count);
+uint16_t EEPROM_extReadVar(EEPROM_ExtDevice* dev, uint16_t id);
+uint8_t EEPROM_extVarExists(EEPROM_ExtDevice* dev, uint16_t id);
+uint8_t EEPROM_extDeleteVar(EEPROM_ExtDevice* dev, uint16_t id);
+uint8_t EEPROM_extReadHistory(EEPROM_ExtDevice* dev, uint16_t id,
+                              uint16_t* out, uint8_t n);
+
+// Set the EEPROM_KEY_BUCKET bit (bit b & 7 of bitmap[b >> 3]) of every
+// stored variable
+void EEPROM_extKeyBitmap(EEPROM_ExtDevice* dev, uint8_t* bitmap);
+
+// Building EEPROM_ext.c with EEPROM_EXT_API defined (instead of EEPROM.c)
+// provides the core EEPROM.h functions on top of the selected device
+void EEPROM_extSelect(EEPROM_ExtDevice* dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EEPROM_EXT_H */
@@ -0,0 +1,184 @@
+/******************************************************************************
+ * EEPROM_layout.h - Flash Storage Library for CH32V003J4M6
+ *
+ * Storage layout and status codes shared by the library, the external
+ * memory backends and the host tools. This header must not depend on
+ * ch32v003fun.h.
+ ******************************************************************************/
+
+#ifndef EEPROM_LAYOUT_H
+#define EEPROM_LAYOUT_H
+
+#include <stdint.h>
+
+// Status codes
+#define EEPROM_OK 0
+#define EEPROM_ERROR 1
+#define EEPROM_DEFERRED 2
+
+// Address for storage - use a safe page
+#ifndef EEPROM_ADDRESS
+#define EEPROM_ADDRESS 0x08003C00
+#endif
+
+// Size of the flash page erased by EEPROM_format
+#define EEPROM_PAGE_SIZE 1024
+
+// Number of shards. Each shard is a page with its own log, and IDs are
+// assigned to shards by EEPROM_SHARD_OF. Compacting a shard only copies
+// the variables of that shard. Shard 0 lives at EEPROM_ADDRESS, further
+// shards occupy the pages below it.
+#ifndef EEPROM_SHARDS
+#define EEPROM_SHARDS 1
+#endif
+
+#define EEPROM_SHARD_OF(id) ((uint8_t)((id) % EEPROM_SHARDS))
+#define EEPROM_SHARD_ADDRESS(shard) \
+    (EEPROM_ADDRESS - (uint32_t)(shard) * EEPROM_PAGE_SIZE)
+
+// Set to 1 to add a cold page below the shards. When a shard is compacted,
+// variables saved fewer than EEPROM_COLD_THRESHOLD times since its last
+// compaction move to the cold page, so compaction only copies hot ones.
+#ifndef EEPROM_COLD_PAGE
+#define EEPROM_COLD_PAGE 0
+#endif
+
+#ifndef EEPROM_COLD_THRESHOLD
+#define EEPROM_COLD_THRESHOLD 2
+#endif
+
+#define EEPROM_COLD_ADDRESS EEPROM_SHARD_ADDRESS(EEPROM_SHARDS)
+
+// Set to 1 to keep cold variables on an external device (see EEPROM_ext.h)
+// instead of an internal cold page. The shards then hold the hot tier only.
+#ifndef EEPROM_COLD_EXTERNAL
+#define EEPROM_COLD_EXTERNAL 0
+#endif
+
+// Cold variables are moved out of the shards
+#define EEPROM_COLD_TIER (EEPROM_COLD_PAGE || EEPROM_COLD_EXTERNAL)
+
+// Number of pages used by the store
+#define EEPROM_PAGES (EEPROM_SHARDS + EEPROM_COLD_PAGE)
+
+// Set to 2 or more to reserve that many pages below the store for the
+// streaming logger (EEPROM_logWrite). The log is a ring of pages, each
+// starting with EEPROM_LOG_MARKER and a 16-bit sequence number, that is
+// programmed in blocks of EEPROM_LOG_BLOCK bytes. One page is always kept
+// erased ahead of the stream, so the ring holds EEPROM_LOG_PAGES - 1 pages
+// of data.
+#ifndef EEPROM_LOG_PAGES
+#define EEPROM_LOG_PAGES 0
+#endif
+
+#define EEPROM_LOG_ADDRESS \
+    EEPROM_SHARD_ADDRESS(EEPROM_PAGES + EEPROM_LOG_PAGES - 1)
+#define EEPROM_LOG_BLOCK 64
+#define EEPROM_LOG_MARKER 0x4C47
+#define EEPROM_LOG_HEADER_SIZE 4
+
+// Set to 1 to reserve a page below the store and the log for crash
+// snapshots (EEPROM_crashSave). The page is kept erased and split into
+// slots of EEPROM_CRASH_BLOCKS 64-byte blocks, each slot holding one
+// snapshot: a header word (EEPROM_CRASH_MARKER and the word count in the
+// high half), up to EEPROM_CRASH_WORDS words, and the XOR of all previous
+// words of the slot as its last word.
+#ifndef EEPROM_CRASH_PAGE
+#define EEPROM_CRASH_PAGE 0
+#endif
+
+// 64-byte blocks per slot: 1, 2, 4 or 8
+#ifndef EEPROM_CRASH_BLOCKS
+#define EEPROM_CRASH_BLOCKS 2
+#endif
+
+#define EEPROM_CRASH_ADDRESS \
+    EEPROM_SHARD_ADDRESS(EEPROM_PAGES + EEPROM_LOG_PAGES)
+#define EEPROM_CRASH_MARKER 0x4352
+#define EEPROM_CRASH_SLOT (EEPROM_CRASH_BLOCKS * 64)
+#define EEPROM_CRASH_WORDS (EEPROM_CRASH_SLOT / 4 - 2)
+
+// Maximum number of distinct variables per shard
+#ifndef EEPROM_MAX_VARS
+#define EEPROM_MAX_VARS 10
+#endif
+
+// Maximum number of distinct variables in all shards
+#define EEPROM_CAPACITY (EEPROM_SHARDS * EEPROM_MAX_VARS)
+
+// Versions of each variable kept when the page is compacted
+#ifndef EEPROM_HISTORY_KEEP
+#define EEPROM_HISTORY_KEEP 1
+#endif
+
+// EEPROM identifiers
+#define EEPROM_MARKER 0x5A5A
+
+// Memory map:
+// EEPROM_ADDRESS + 0: Marker (16-bit)
+// EEPROM_ADDRESS + 2: Summary (16-bit, see EEPROM_SUMMARY_BIT)
+// EEPROM_ADDRESS + 4: Variable log (triplets of 16-bit: ID, Value, CRC)
+//
+// Records are appended until the page is full; the newest record of an ID
+// is its current value. A full page is compacted into a fresh page that
+// keeps the newest EEPROM_HISTORY_KEEP versions of every ID.
+#define EEPROM_HEADER_SIZE 4
+#define EEPROM_RECORD_SIZE 6
+
+// Record slots per page, and the slots after the end of a log that are
+// checked for torn writes (as many as one flash block touches). The end of
+// a log is the first slot with an erased ID, found by binary search, unless
+// one of the EEPROM_END_CHECK slots after it is not fully erased: then the
+// end moves past that slot. EEPROM.c, EEPROM_reader.h and
+// tools/eeprom_image.c all find the end this way.
+#define EEPROM_SLOTS \
+    ((EEPROM_PAGE_SIZE - EEPROM_HEADER_SIZE) / EEPROM_RECORD_SIZE)
+#define EEPROM_END_CHECK (EEPROM_LOG_BLOCK / EEPROM_RECORD_SIZE + 1)
+
+// The summary has one bit per group of IDs present in the page and is
+// written when the page is compacted. Lookups skip a page whose summary
+// lacks the bit of the ID. 0x0000 (shards, older pages) means no summary.
+#define EEPROM_SUMMARY_BIT(id) \
+    ((uint16_t)(1u << (((id) ^ ((id) >> 4) ^ ((id) >> 8) ^ ((id) >> 12)) & \
+                       0x0F)))
+#define EEPROM_SUMMARY_NONE 0x0000
+
+// Keys are 16-bit; 0xFFFF is reserved (it reads as an empty slot) and so is
+// EEPROM_KEY_CLEAR. RAM key directories keep one bit per bucket, the low
+// and high key bytes folded together so that both 8-bit IDs and sparse wide
+// keys spread evenly.
+#define EEPROM_KEY_NONE 0xFFFF
+#define EEPROM_KEY_BUCKET(key) ((uint8_t)((key) ^ ((key) >> 8)))
+
+// A generation record (key EEPROM_KEY_CLEAR, value the generation) starts a
+// new generation of the store. EEPROM_clear appends one to shard 0: the
+// newest one there is the current generation (0 when there is none), and
+// the records before it are void. Every other page is written with a
+// generation record first (none for generation 0), and a page of another
+// generation is void as a whole.
+#define EEPROM_KEY_CLEAR 0xFFFE
+
+// Update script (little-endian 16-bit words):
+// count, then count pairs of ID, Value, then the XOR of all previous words
+#define EEPROM_UPDATE_WORDS(count) (2 + 2 * (count))
+
+// Pairs one script can hold: it is committed as one EEPROM_saveKeys batch
+#define EEPROM_UPDATE_MAX 255
+
+// Simple CRC calculation
+static inline uint16_t EEPROM_calcCRC(uint16_t id, uint16_t value) {
+    return (uint16_t)(id ^ value);
+}
+
+// A tombstone marks a variable as deleted: a record holding
+// EEPROM_TOMBSTONE_VALUE whose CRC is inverted by EEPROM_TOMBSTONE_MASK, so
+// it never passes as data (and older firmware just skips it)
+#define EEPROM_TOMBSTONE_VALUE 0x0000
+#define EEPROM_TOMBSTONE_MASK 0xA5A5
+
+static inline uint16_t EEPROM_tombstoneCRC(uint16_t id) {
+    return (uint16_t)(EEPROM_calcCRC(id, EEPROM_TOMBSTONE_VALUE) ^
+                      EEPROM_TOMBSTONE_MASK);
+}
+
+#endif /* EEPROM_LAYOUT_H */
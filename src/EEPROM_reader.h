@@ -0,0 +1,121 @@
+/******************************************************************************
+ * EEPROM_reader.h - Read-only access to the EEPROM store
+ *
+ * Only the lookup code, for bootloaders and other images that need a few
+ * stored settings but cannot afford EEPROM.c: no FLASH register access, no
+ * write paths and no RAM state. Build it with the same layout macros as the
+ * application (EEPROM_ADDRESS, EEPROM_SHARDS, EEPROM_COLD_PAGE) so that
+ * both see the same pages. Values in an external cold tier, and saves still
+ * held in RAM by the application, are not visible.
+ *
+ * tools/reader_size.sh checks the code size against its budget.
+ ******************************************************************************/
+
+#ifndef EEPROM_READER_H
+#define EEPROM_READER_H
+
+#include <stdint.h>
+
+#include "EEPROM_layout.h"
+
+// Find the newest record of a key in one page: 1 when it holds a value
+// (stored in *value), 2 when it is a tombstone, 0 when there is none. With
+// key EEPROM_KEY_CLEAR it finds the generation of the page.
+static inline uint8_t EEPROM_readerScan(uint32_t base, uint16_t key,
+                                        uint16_t* value) {
+    uint32_t start = base + EEPROM_HEADER_SIZE;
+    uint16_t low = 0;
+    uint16_t high = EEPROM_SLOTS;
+    uint8_t found = 0;
+
+    // The page is mounted when it carries the marker
+    if (*(volatile uint16_t*)base != EEPROM_MARKER) return 0;
+
+    // The log ends where EEPROM.c finds its end (see EEPROM_END_CHECK): at
+    // the first erased ID, or past programmed half-words a torn write left
+    // in the EEPROM_END_CHECK slots after it
+    while (low < high) {
+        uint16_t mid = (uint16_t)((low + high) / 2);
+
+        if (*(volatile uint16_t*)(start + mid * EEPROM_RECORD_SIZE) !=
+            0xFFFF) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    uint16_t limit = low + EEPROM_END_CHECK;
+
+    for (uint16_t slot = 0; slot < EEPROM_SLOTS && slot < limit; slot++) {
+        const volatile uint16_t* record =
+            (const volatile uint16_t*)(start + slot * EEPROM_RECORD_SIZE);
+
+        if (slot >= low && (record[0] & record[1] & record[2]) != 0xFFFF) {
+            limit = slot + 1 + EEPROM_END_CHECK;
+        }
+
+        // Erased IDs inside the log are left by torn writes
+        if (record[0] == EEPROM_KEY_NONE) continue;
+
+        // Records before a generation record are void
+        if (record[0] == EEPROM_KEY_CLEAR) found = 0;
+        if (record[0] != key) continue;
+
+        if (record[2] == EEPROM_calcCRC(key, record[1])) {
+            *value = record[1];
+            found = 1;
+        } else if (record[1] == EEPROM_TOMBSTONE_VALUE &&
+                   record[2] == EEPROM_tombstoneCRC(key)) {
+            found = 2;
+        }
+    }
+
+    return found;
+}
+
+#if EEPROM_SHARDS > 1 || EEPROM_COLD_PAGE
+// Scan a page other than shard 0, which is void unless it belongs to the
+// current generation gen (see EEPROM_KEY_CLEAR)
+static inline uint8_t EEPROM_readerScanLive(uint32_t base, uint16_t gen,
+                                            uint16_t key, uint16_t* value) {
+    uint16_t pageGen = 0;
+
+    EEPROM_readerScan(base, EEPROM_KEY_CLEAR, &pageGen);
+    if (pageGen != gen) return 0;
+
+    return EEPROM_readerScan(base, key, value);
+}
+#endif
+
+// Read a key (or an 8-bit ID); returns 0xFFFF when it is not stored
+static inline uint16_t EEPROM_readerRead(uint16_t key) {
+    uint16_t value = 0xFFFF;
+    uint8_t found;
+
+#if EEPROM_SHARDS > 1 || EEPROM_COLD_PAGE
+    uint16_t gen = 0;
+
+    EEPROM_readerScan(EEPROM_SHARD_ADDRESS(0), EEPROM_KEY_CLEAR, &gen);
+
+    if (EEPROM_SHARD_OF(key) == 0) {
+        found = EEPROM_readerScan(EEPROM_SHARD_ADDRESS(0), key, &value);
+    } else {
+        found = EEPROM_readerScanLive(
+            EEPROM_SHARD_ADDRESS(EEPROM_SHARD_OF(key)), gen, key, &value);
+    }
+#else
+    found = EEPROM_readerScan(EEPROM_SHARD_ADDRESS(0), key, &value);
+#endif
+
+#if EEPROM_COLD_PAGE
+    // The shard is newer than the cold page, tombstones included
+    if (found == 0) {
+        found = EEPROM_readerScanLive(EEPROM_COLD_ADDRESS, gen, key, &value);
+    }
+#endif
+
+    return found == 1 ? value : 0xFFFF;
+}
+
+#endif /* EEPROM_READER_H */
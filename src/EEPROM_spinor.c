@@ -0,0 +1,120 @@
+/******************************************************************************
+ * EEPROM_spinor.c - SPI NOR flash driver for the external backend
+ *
+ * Uses the common 25-series command set: 256-byte page program, 4KB sector
+ * erase and WIP polling through the status register. Devices up to 16MB
+ * (3-byte addressing) are supported.
+ ******************************************************************************/
+
+#include "EEPROM_ext.h"
+
+#include <stddef.h>
+
+#define SPINOR_CMD_READ 0x03
+#define SPINOR_CMD_WREN 0x06
+#define SPINOR_CMD_PP 0x02
+#define SPINOR_CMD_SE 0x20
+#define SPINOR_CMD_RDSR 0x05
+
+#define SPINOR_SR_WIP 0x01
+
+#define SPINOR_PAGE_SIZE 256
+#define SPINOR_SECTOR_SIZE 4096
+
+// Send a command with an optional 3-byte address
+static void EEPROM_spinorCommand(const EEPROM_SPIBus* bus, uint8_t cmd,
+                                 const uint32_t* addr) {
+    uint8_t head[4] = {cmd, 0, 0, 0};
+    uint16_t len = 1;
+
+    if (addr) {
+        head[1] = (uint8_t)(*addr >> 16);
+        head[2] = (uint8_t)(*addr >> 8);
+        head[3] = (uint8_t)*addr;
+        len = 4;
+    }
+
+    bus->transfer(bus->ctx, head, NULL, len);
+}
+
+// Wait until the write in progress bit clears
+static uint8_t EEPROM_spinorWait(EEPROM_ExtDevice* dev) {
+    const EEPROM_SPIBus* bus = (const EEPROM_SPIBus*)dev->bus;
+    uint8_t status = SPINOR_SR_WIP;
+
+    bus->select(bus->ctx, 1);
+    EEPROM_spinorCommand(bus, SPINOR_CMD_RDSR, NULL);
+
+    // The status register is sent continuously while selected
+    for (uint32_t i = 0; i < EEPROM_EXT_POLL_LIMIT; i++) {
+        bus->transfer(bus->ctx, NULL, &status, 1);
+        if (!(status & SPINOR_SR_WIP)) break;
+        dev->stats.polls++;
+    }
+
+    bus->select(bus->ctx, 0);
+    return (status & SPINOR_SR_WIP) ? EEPROM_ERROR : EEPROM_OK;
+}
+
+static void EEPROM_spinorWriteEnable(const EEPROM_SPIBus* bus) {
+    bus->select(bus->ctx, 1);
+    EEPROM_spinorCommand(bus, SPINOR_CMD_WREN, NULL);
+    bus->select(bus->ctx, 0);
+}
+
+static uint8_t EEPROM_spinorRead(EEPROM_ExtDevice* dev, uint32_t addr,
+                                 uint8_t* data, uint16_t len) {
+    const EEPROM_SPIBus* bus = (const EEPROM_SPIBus*)dev->bus;
+
+    bus->select(bus->ctx, 1);
+    EEPROM_spinorCommand(bus, SPINOR_CMD_READ, &addr);
+    bus->transfer(bus->ctx, NULL, data, len);
+    bus->select(bus->ctx, 0);
+
+    return EEPROM_OK;
+}
+
+static uint8_t EEPROM_spinorWrite(EEPROM_ExtDevice* dev, uint32_t addr,
+                                  const uint8_t* data, uint16_t len) {
+    const EEPROM_SPIBus* bus = (const EEPROM_SPIBus*)dev->bus;
+
+    EEPROM_spinorWriteEnable(bus);
+
+    bus->select(bus->ctx, 1);
+    EEPROM_spinorCommand(bus, SPINOR_CMD_PP, &addr);
+    bus->transfer(bus->ctx, data, NULL, len);
+    bus->select(bus->ctx, 0);
+
+    return EEPROM_spinorWait(dev);
+}
+
+static uint8_t EEPROM_spinorErase(EEPROM_ExtDevice* dev, uint32_t addr) {
+    const EEPROM_SPIBus* bus = (const EEPROM_SPIBus*)dev->bus;
+
+    EEPROM_spinorWriteEnable(bus);
+
+    bus->select(bus->ctx, 1);
+    EEPROM_spinorCommand(bus, SPINOR_CMD_SE, &addr);
+    bus->select(bus->ctx, 0);
+
+    return EEPROM_spinorWait(dev);
+}
+
+// Set up a device using size bytes from base (both sector aligned)
+void EEPROM_spinorInit(EEPROM_ExtDevice* dev, const EEPROM_SPIBus* bus,
+                       uint32_t base, uint32_t size) {
+    dev->read = EEPROM_spinorRead;
+    dev->write = EEPROM_spinorWrite;
+    dev->erase = EEPROM_spinorErase;
+    dev->bus = bus;
+    dev->busAddr = 0;
+    dev->addrBytes = 3;
+
+    dev->base = base;
+    dev->size = size;
+    dev->pageSize = SPINOR_PAGE_SIZE;
+    dev->sectorSize = SPINOR_SECTOR_SIZE;
+
+    dev->end = 0;
+    dev->stats = (EEPROM_ExtStats){0, 0, 0, 0, 0};
+}
@@ -0,0 +1,711 @@
+/******************************************************************************
+ * eeprom_image.c - Host tool for CH32V003 EEPROM storage images
+ *
+ * Builds a ready-to-flash storage image from a parameter list, decodes
+ * images read back from devices and diffs them against a new parameter set.
+ *
+ * Build: cc -O2 -Wall -Isrc -o eeprom_image tools/eeprom_image.c
+ *
+ * Usage:
+ *   eeprom_image build <params.csv|params.json> <out.bin|out.hex>
+ *   eeprom_image decode [-a] <image.bin|image.hex>
+ *   eeprom_image diff <image.bin|image.hex> <params> <update.bin|update.csv>
+ *
+ * Parameter files list one variable per line as "id,type,value" (or
+ * "id,value"), or as a JSON array of {"id":..,"type":..,"value":..}
+ * objects. Supported types are u16 (default) and i16. Images cover all
+ * EEPROM_PAGES pages (shards and cold page), starting at the lowest one;
+ * .hex files carry the address, .bin files start at it. Build the tool with
+ * the same EEPROM_SHARDS, EEPROM_COLD_PAGE and EEPROM_MAX_VARS as the
+ * firmware.
+ *
+ * diff writes only the variables whose value differs from the dumped image,
+ * either as CSV or as a binary update script for EEPROM_applyUpdate().
+ ******************************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EEPROM_layout.h"
+
+#define MAX_ENTRIES 256
+
+// The image spans all pages, shard 0 is the last one and the cold page
+// (when enabled) the first one
+#define IMAGE_BASE EEPROM_SHARD_ADDRESS(EEPROM_PAGES - 1)
+#define IMAGE_SIZE (EEPROM_PAGES * EEPROM_PAGE_SIZE)
+#define PAGE_OFFSET(shard) (EEPROM_SHARD_ADDRESS(shard) - IMAGE_BASE)
+
+typedef struct {
+    uint16_t id;
+    uint16_t value;
+    uint8_t deleted;  // Decoded from a tombstone
+} Entry;
+
+static uint16_t getHalfWord(const uint8_t* page, uint32_t offset) {
+    return (uint16_t)(page[offset] | (page[offset + 1] << 8));
+}
+
+static void putHalfWord(uint8_t* page, uint32_t offset, uint16_t data) {
+    page[offset] = (uint8_t)data;
+    page[offset + 1] = (uint8_t)(data >> 8);
+}
+
+static int hasSuffix(const char* path, const char* suffix) {
+    size_t n = strlen(path), m = strlen(suffix);
+    return n >= m && strcmp(path + n - m, suffix) == 0;
+}
+
+/* ---------------------------------------------------------------------------
+ * Parameter files
+ * ------------------------------------------------------------------------- */
+
+// Convert a typed value to the stored 16-bit representation
+static int parseValue(const char* type, const char* text, uint16_t* value) {
+    char* end;
+    long v = strtol(text, &end, 0);
+
+    while (isspace((unsigned char)*end)) end++;
+    if (end == text || *end != '\0') return -1;
+
+    if (type[0] == '\0' || strcmp(type, "u16") == 0) {
+        if (v < 0 || v > 0xFFFF) return -1;
+    } else if (strcmp(type, "i16") == 0) {
+        if (v < -32768 || v > 32767) return -1;
+    } else {
+        return -1;
+    }
+
+    *value = (uint16_t)v;
+    return 0;
+}
+
+// Store an entry, a later entry for the same ID replaces the earlier one
+static int addEntry(Entry* entries, int* count, long id, const char* type,
+                    const char* text, int line) {
+    uint16_t value;
+
+    if (id < 0 || id >= EEPROM_KEY_CLEAR) {
+        fprintf(stderr, "line %d: id %ld out of range\n", line, id);
+        return -1;
+    }
+    if (parseValue(type, text, &value) != 0) {
+        fprintf(stderr, "line %d: bad %s value '%s'\n", line,
+                type[0] ? type : "u16", text);
+        return -1;
+    }
+
+    for (int i = 0; i < *count; i++) {
+        if (entries[i].id == id) {
+            entries[i].value = value;
+            return 0;
+        }
+    }
+    if (*count >= MAX_ENTRIES) {
+        fprintf(stderr, "line %d: too many entries\n", line);
+        return -1;
+    }
+
+    entries[*count].id = (uint16_t)id;
+    entries[*count].value = value;
+    entries[*count].deleted = 0;
+    (*count)++;
+    return 0;
+}
+
+static char* trim(char* s) {
+    char* end;
+
+    while (isspace((unsigned char)*s)) s++;
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+    return s;
+}
+
+// CSV: "id,type,value" or "id,value", '#' starts a comment
+static int parseCSV(char* text, Entry* entries, int* count) {
+    int line = 0;
+
+    for (char* row = strtok(text, "\n"); row; row = strtok(NULL, "\n")) {
+        char* fields[3];
+        int n = 0;
+
+        line++;
+        char* hash = strchr(row, '#');
+        if (hash) *hash = '\0';
+        row = trim(row);
+        if (*row == '\0') continue;
+
+        for (char* f = row; f && n < 3; n++) {
+            char* comma = strchr(f, ',');
+            if (comma) *comma++ = '\0';
+            fields[n] = trim(f);
+            f = comma;
+        }
+
+        // Skip a header row
+        if (line == 1 && !isdigit((unsigned char)fields[0][0])) continue;
+
+        char* end;
+        long id = strtol(fields[0], &end, 0);
+        if (end == fields[0] || *end != '\0' || n < 2) {
+            fprintf(stderr, "line %d: expected id,type,value\n", line);
+            return -1;
+        }
+
+        if (addEntry(entries, count, id, n == 3 ? fields[1] : "",
+                     fields[n - 1], line) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Copy a JSON scalar (number or string) into buf
+static const char* jsonScalar(const char* p, char* buf, size_t size) {
+    size_t n = 0;
+
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '"') {
+        p++;
+        while (*p && *p != '"') {
+            if (n + 1 < size) buf[n++] = *p;
+            p++;
+        }
+        if (*p == '"') p++;
+    } else {
+        while (*p && *p != ',' && *p != '}' && !isspace((unsigned char)*p)) {
+            if (n + 1 < size) buf[n++] = *p;
+            p++;
+        }
+    }
+    buf[n] = '\0';
+    return p;
+}
+
+// JSON: a flat array of {"id":..,"type":..,"value":..} objects
+static int parseJSON(const char* p, Entry* entries, int* count) {
+    int object = 0;
+
+    while ((p = strchr(p, '{')) != NULL) {
+        char id[16] = "", type[16] = "", value[32] = "";
+
+        object++;
+        p++;
+        while (*p && *p != '}') {
+            char key[16];
+
+            p = strchr(p, '"');
+            if (!p) break;
+            p = jsonScalar(p, key, sizeof(key));
+            while (isspace((unsigned char)*p)) p++;
+            if (*p != ':') break;
+            p++;
+
+            if (strcmp(key, "id") == 0) {
+                p = jsonScalar(p, id, sizeof(id));
+            } else if (strcmp(key, "type") == 0) {
+                p = jsonScalar(p, type, sizeof(type));
+            } else {
+                char skip[32];
+                p = jsonScalar(p, strcmp(key, "value") == 0 ? value : skip,
+                               sizeof(value));
+            }
+            while (isspace((unsigned char)*p) || *p == ',') p++;
+        }
+
+        char* end;
+        long n = strtol(id, &end, 0);
+        if (id[0] == '\0' || *end != '\0' || value[0] == '\0') {
+            fprintf(stderr, "object %d: expected id and value\n", object);
+            return -1;
+        }
+        if (addEntry(entries, count, n, type, value, object) != 0) return -1;
+    }
+
+    return 0;
+}
+
+static char* readText(const char* path) {
+    FILE* f = fopen(path, "rb");
+    char* text;
+    long size;
+
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    text = malloc((size_t)size + 1);
+    if (text && fread(text, 1, (size_t)size, f) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    if (text) text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+static int loadParams(const char* path, Entry* entries, int* count) {
+    char* text = readText(path);
+    char* p;
+    int status;
+
+    if (!text) return -1;
+
+    *count = 0;
+    p = text;
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '[' || *p == '{') {
+        status = parseJSON(p, entries, count);
+    } else {
+        status = parseCSV(text, entries, count);
+    }
+
+    free(text);
+    return status;
+}
+
+/* ---------------------------------------------------------------------------
+ * Images
+ * ------------------------------------------------------------------------- */
+
+// Lay out freshly compacted shard pages holding the given values
+static int buildImage(const Entry* entries, int count, uint8_t* image) {
+    memset(image, 0xFF, IMAGE_SIZE);
+
+    for (uint8_t shard = 0; shard < EEPROM_SHARDS; shard++) {
+        uint8_t* page = image + PAGE_OFFSET(shard);
+        uint32_t offset = EEPROM_HEADER_SIZE;
+        int shardCount = 0;
+
+        putHalfWord(page, 0, EEPROM_MARKER);
+        putHalfWord(page, 2, 0);
+
+        for (int i = 0; i < count; i++) {
+            if (EEPROM_SHARD_OF(entries[i].id) != shard) continue;
+
+            if (++shardCount > EEPROM_MAX_VARS) {
+                fprintf(stderr, "shard %u exceeds EEPROM_MAX_VARS (%d)\n",
+                        shard, EEPROM_MAX_VARS);
+                return -1;
+            }
+
+            putHalfWord(page, offset, entries[i].id);
+            putHalfWord(page, offset + 2, entries[i].value);
+            putHalfWord(page, offset + 4,
+                        EEPROM_calcCRC(entries[i].id, entries[i].value));
+            offset += EEPROM_RECORD_SIZE;
+        }
+    }
+
+    return 0;
+}
+
+// Offset of the end of the log in a page, found as EEPROM.c finds it (see
+// EEPROM_END_CHECK): the first erased ID, or past programmed half-words a
+// torn write left in the slots after it
+static uint32_t pageEnd(const uint8_t* page) {
+    uint32_t low = 0;
+    uint32_t high = EEPROM_SLOTS;
+
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+
+        if (getHalfWord(page, EEPROM_HEADER_SIZE +
+                                  mid * EEPROM_RECORD_SIZE) != 0xFFFF) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    uint32_t end = low;
+
+    for (uint32_t slot = low;
+         slot < EEPROM_SLOTS && slot < end + EEPROM_END_CHECK; slot++) {
+        uint32_t offset = EEPROM_HEADER_SIZE + slot * EEPROM_RECORD_SIZE;
+
+        if ((getHalfWord(page, offset) & getHalfWord(page, offset + 2) &
+             getHalfWord(page, offset + 4)) != 0xFFFF) {
+            end = slot + 1;
+        }
+    }
+
+    return EEPROM_HEADER_SIZE + end * EEPROM_RECORD_SIZE;
+}
+
+// Decode the records of one page. Entries before fixed come from a page
+// that takes precedence and are not replaced.
+static int decodePage(const uint8_t* page, int shard, Entry* entries,
+                      int* count, int fixed, int all) {
+    uint32_t end = pageEnd(page);
+
+    for (uint32_t offset = EEPROM_HEADER_SIZE; offset < end;
+         offset += EEPROM_RECORD_SIZE) {
+        uint16_t id = getHalfWord(page, offset);
+        uint16_t value = getHalfWord(page, offset + 2);
+        uint16_t crc = getHalfWord(page, offset + 4);
+        int i = *count;
+
+        int deleted = value == EEPROM_TOMBSTONE_VALUE &&
+                      crc == EEPROM_tombstoneCRC(id);
+
+        // Erased IDs inside the log are left by torn writes
+        if (id == EEPROM_KEY_NONE) continue;
+        if (crc != EEPROM_calcCRC(id, value) && !deleted) continue;
+
+        // Records before a generation record are void
+        if (id == EEPROM_KEY_CLEAR) {
+            *count = fixed;
+            continue;
+        }
+
+        // The device never looks for an ID outside its shard
+        if (shard >= 0 && EEPROM_SHARD_OF(id) != shard) continue;
+
+        if (!all) {
+            for (i = 0; i < *count; i++) {
+                if (entries[i].id == id) break;
+            }
+            if (i < fixed) continue;
+        }
+        if (i >= MAX_ENTRIES) return -1;
+
+        entries[i].id = id;
+        entries[i].value = value;
+        entries[i].deleted = (uint8_t)deleted;
+        if (i == *count) (*count)++;
+    }
+
+    return 0;
+}
+
+// Read back the values held by an image the same way the device does. With
+// all set, every valid record is returned in log order instead.
+static int decodeImage(const uint8_t* image, Entry* entries, int* count,
+                       int all) {
+    const uint8_t* shard0 = image + PAGE_OFFSET(0);
+    uint32_t end = pageEnd(shard0);
+    uint16_t gen = 0;
+
+    *count = 0;
+
+    // The newest generation record of shard 0 is the current generation
+    for (uint32_t offset = EEPROM_HEADER_SIZE; offset < end;
+         offset += EEPROM_RECORD_SIZE) {
+        uint16_t id = getHalfWord(shard0, offset);
+        uint16_t value = getHalfWord(shard0, offset + 2);
+
+        if (id == EEPROM_KEY_CLEAR &&
+            getHalfWord(shard0, offset + 4) == EEPROM_calcCRC(id, value)) {
+            gen = value;
+        }
+    }
+
+    for (uint8_t shard = 0; shard < EEPROM_PAGES; shard++) {
+        const uint8_t* page = image + PAGE_OFFSET(shard);
+        int fixed = *count;
+
+        if (getHalfWord(page, 0) != EEPROM_MARKER) {
+            if (shard < EEPROM_SHARDS) {
+                fprintf(stderr, "shard %u is not initialized (no marker)\n",
+                        shard);
+            }
+            continue;
+        }
+
+        // Other pages carry their generation in their first record
+        if (shard > 0) {
+            uint16_t first = getHalfWord(page, EEPROM_HEADER_SIZE);
+            uint16_t value = getHalfWord(page, EEPROM_HEADER_SIZE + 2);
+            uint16_t crc = getHalfWord(page, EEPROM_HEADER_SIZE + 4);
+            int valid = first == EEPROM_KEY_CLEAR &&
+                        crc == EEPROM_calcCRC(first, value);
+
+            if ((valid ? value : 0) != gen) continue;
+        }
+
+        // Values in the cold page only count when no shard holds the ID
+        if (decodePage(page, shard < EEPROM_SHARDS ? shard : -1, entries,
+                       count, fixed, all) != 0) {
+            return -1;
+        }
+    }
+
+    // Deleted variables only hide older values
+    if (!all) {
+        int kept = 0;
+
+        for (int i = 0; i < *count; i++) {
+            if (!entries[i].deleted) entries[kept++] = entries[i];
+        }
+        *count = kept;
+    }
+
+    return 0;
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parse an Intel HEX file, keeping only the bytes inside the storage image
+static int loadHex(const char* path, uint8_t* image) {
+    char* text = readText(path);
+    uint32_t upper = 0;
+    int status = 0;
+
+    if (!text) return -1;
+
+    for (char* line = strtok(text, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        uint8_t rec[262];
+        size_t len = strlen(line);
+        uint8_t sum = 0;
+
+        if (line[0] != ':' || len < 11 || (len - 1) % 2 != 0 ||
+            (len - 1) / 2 > sizeof(rec)) {
+            status = -1;
+            break;
+        }
+        for (size_t i = 0; i < (len - 1) / 2; i++) {
+            int hi = hexDigit(line[1 + 2 * i]), lo = hexDigit(line[2 + 2 * i]);
+            if (hi < 0 || lo < 0) {
+                status = -1;
+                break;
+            }
+            rec[i] = (uint8_t)(hi << 4 | lo);
+            sum += rec[i];
+        }
+        if (status != 0 || sum != 0 || (size_t)rec[0] + 5 != (len - 1) / 2) {
+            status = -1;
+            break;
+        }
+
+        uint32_t addr = upper | (uint32_t)(rec[1] << 8 | rec[2]);
+        if (rec[3] == 0x00) {
+            for (uint8_t i = 0; i < rec[0]; i++) {
+                uint32_t a = addr + i;
+                if (a >= IMAGE_BASE && a < IMAGE_BASE + IMAGE_SIZE) {
+                    image[a - IMAGE_BASE] = rec[4 + i];
+                }
+            }
+        } else if (rec[3] == 0x01) {
+            break;
+        } else if (rec[3] == 0x04 && rec[0] == 2) {
+            upper = (uint32_t)(rec[4] << 8 | rec[5]) << 16;
+        }
+    }
+
+    if (status != 0) fprintf(stderr, "%s: malformed Intel HEX\n", path);
+    free(text);
+    return status;
+}
+
+static int loadImage(const char* path, uint8_t* image) {
+    memset(image, 0xFF, IMAGE_SIZE);
+
+    if (hasSuffix(path, ".hex")) return loadHex(path, image);
+
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    size_t n = fread(image, 1, IMAGE_SIZE, f);
+    fclose(f);
+
+    if (n < IMAGE_SIZE) {
+        fprintf(stderr, "%s: image too short\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void writeHexRecord(FILE* f, uint8_t type, uint16_t addr,
+                           const uint8_t* data, uint8_t len) {
+    uint8_t sum = (uint8_t)(len + (addr >> 8) + addr + type);
+
+    fprintf(f, ":%02X%04X%02X", len, addr, type);
+    for (uint8_t i = 0; i < len; i++) {
+        fprintf(f, "%02X", data[i]);
+        sum += data[i];
+    }
+    fprintf(f, "%02X\n", (uint8_t)-sum);
+}
+
+static int writeImage(const char* path, const uint8_t* image) {
+    FILE* f = fopen(path, "wb");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    if (hasSuffix(path, ".hex")) {
+        uint8_t upper[2] = {(uint8_t)(IMAGE_BASE >> 24),
+                            (uint8_t)(IMAGE_BASE >> 16)};
+
+        writeHexRecord(f, 0x04, 0, upper, 2);
+        for (uint32_t offset = 0; offset < IMAGE_SIZE; offset += 16) {
+            writeHexRecord(f, 0x00, (uint16_t)(IMAGE_BASE + offset),
+                           image + offset, 16);
+        }
+        writeHexRecord(f, 0x01, 0, NULL, 0);
+    } else {
+        fwrite(image, 1, IMAGE_SIZE, f);
+    }
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* ---------------------------------------------------------------------------
+ * Commands
+ * ------------------------------------------------------------------------- */
+
+static int cmdBuild(const char* params, const char* out) {
+    Entry entries[MAX_ENTRIES];
+    uint8_t image[IMAGE_SIZE];
+    int count;
+
+    if (loadParams(params, entries, &count) != 0) return 1;
+    if (buildImage(entries, count, image) != 0) return 1;
+    if (writeImage(out, image) != 0) return 1;
+
+    printf("%s: %d variables at 0x%08X\n", out, count, IMAGE_BASE);
+    return 0;
+}
+
+static int cmdDecode(const char* path, int all) {
+    Entry entries[MAX_ENTRIES];
+    uint8_t image[IMAGE_SIZE];
+    int count;
+
+    if (loadImage(path, image) != 0) return 1;
+    if (decodeImage(image, entries, &count, all) != 0) return 1;
+
+    printf("id,type,value\n");
+    for (int i = 0; i < count; i++) {
+        if (entries[i].deleted) {
+            printf("%u,deleted,\n", entries[i].id);
+        } else {
+            printf("%u,u16,%u\n", entries[i].id, entries[i].value);
+        }
+    }
+    return 0;
+}
+
+// Write the entries as an update script for EEPROM_applyUpdate()
+static int writeUpdate(const char* path, const Entry* entries, int count) {
+    uint8_t script[EEPROM_UPDATE_WORDS(MAX_ENTRIES) * 2];
+    uint16_t check = 0;
+    uint32_t words = EEPROM_UPDATE_WORDS(count);
+    FILE* f;
+
+    putHalfWord(script, 0, (uint16_t)count);
+    for (int i = 0; i < count; i++) {
+        putHalfWord(script, 2 + 4 * i, entries[i].id);
+        putHalfWord(script, 4 + 4 * i, entries[i].value);
+    }
+    for (uint32_t i = 0; i + 1 < words; i++) {
+        check ^= getHalfWord(script, 2 * i);
+    }
+    putHalfWord(script, 2 * (words - 1), check);
+
+    f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fwrite(script, 2, words, f);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static int cmdDiff(const char* path, const char* params, const char* out) {
+    Entry current[MAX_ENTRIES], target[MAX_ENTRIES], changes[MAX_ENTRIES];
+    uint8_t image[IMAGE_SIZE];
+    int currentCount, targetCount, count = 0;
+
+    if (loadImage(path, image) != 0) return 1;
+    if (decodeImage(image, current, &currentCount, 0) != 0) return 1;
+    if (loadParams(params, target, &targetCount) != 0) return 1;
+
+    // Keep only the variables that are missing or hold another value
+    for (int i = 0; i < targetCount; i++) {
+        int j;
+
+        for (j = 0; j < currentCount; j++) {
+            if (current[j].id == target[i].id) break;
+        }
+        if (j < currentCount && current[j].value == target[i].value) continue;
+
+        changes[count++] = target[i];
+    }
+
+    if (count > EEPROM_CAPACITY) {
+        fprintf(stderr, "%d changes exceed EEPROM_CAPACITY (%d)\n", count,
+                EEPROM_CAPACITY);
+        return 1;
+    }
+    if (count > EEPROM_UPDATE_MAX) {
+        fprintf(stderr, "%d changes exceed one script (%d)\n", count,
+                EEPROM_UPDATE_MAX);
+        return 1;
+    }
+
+    if (hasSuffix(out, ".csv")) {
+        FILE* f = fopen(out, "w");
+
+        if (!f) {
+            perror(out);
+            return 1;
+        }
+        fprintf(f, "id,type,value\n");
+        for (int i = 0; i < count; i++) {
+            fprintf(f, "%u,u16,%u\n", changes[i].id, changes[i].value);
+        }
+        if (fclose(f) != 0) return 1;
+    } else if (writeUpdate(out, changes, count) != 0) {
+        return 1;
+    }
+
+    printf("%s: %d of %d variables changed (%u bytes)\n", out, count,
+           targetCount, EEPROM_UPDATE_WORDS(count) * 2);
+    return 0;
+}
+
+static int usage(void) {
+    fprintf(stderr,
+            "usage: eeprom_image build <params.csv|params.json> "
+            "<out.bin|out.hex>\n"
+            "       eeprom_image decode [-a] <image.bin|image.hex>\n"
+            "       eeprom_image diff <image.bin|image.hex> <params> "
+            "<update.bin|update.csv>\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && strcmp(argv[1], "build") == 0) {
+        return cmdBuild(argv[2], argv[3]);
+    }
+    if (argc == 3 && strcmp(argv[1], "decode") == 0) {
+        return cmdDecode(argv[2], 0);
+    }
+    if (argc == 4 && strcmp(argv[1], "decode") == 0 &&
+        strcmp(argv[2], "-a") == 0) {
+        return cmdDecode(argv[3], 1);
+    }
+    if (argc == 5 && strcmp(argv[1], "diff") == 0) {
+        return cmdDiff(argv[2], argv[3], argv[4]);
+    }
+    return usage();
+}
@@ -0,0 +1,95 @@
+/******************************************************************************
+ * ext_bench.c - Host benchmark of the external memory backends
+ *
+ * Runs the same save workload against a simulated 24C256 I2C EEPROM and a
+ * simulated SPI NOR flash, single saves and batched saves, then remounts
+ * the device and checks every value. Reports simulated saves per second,
+ * bytes and transactions written, erases and the wear of the most used
+ * page (24Cxx) or sector (NOR).
+ *
+ * Build: cc -O2 -Wall -Isrc -Itools/sim -o ext_bench tools/ext_bench.c \
+ *            tools/sim/sim_24cxx.c tools/sim/sim_spinor.c \
+ *            src/EEPROM_ext.c src/EEPROM_24cxx.c src/EEPROM_spinor.c
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "EEPROM_ext.h"
+#include "sim_24cxx.h"
+#include "sim_spinor.h"
+
+#define BENCH_VARS 16
+#define BENCH_SAVES 20000
+#define BENCH_BATCH 8
+
+// Save BENCH_SAVES values, BENCH_BATCH at a time, and check them after a
+// remount. Returns the number of mismatches.
+static uint32_t runWorkload(EEPROM_ExtDevice* dev, uint8_t batch) {
+    uint16_t expect[BENCH_VARS];
+    uint16_t ids[BENCH_BATCH];
+    uint16_t values[BENCH_BATCH];
+    uint32_t errors = 0;
+
+    EEPROM_extFormat(dev);
+    dev->stats = (EEPROM_ExtStats){0, 0, 0, 0, 0};
+
+    for (uint32_t n = 0; n < BENCH_SAVES; n += batch) {
+        for (uint8_t i = 0; i < batch; i++) {
+            ids[i] = (uint16_t)((n + i) % BENCH_VARS);
+            values[i] = (uint16_t)(n + i);
+            expect[ids[i]] = values[i];
+        }
+        if (EEPROM_extSaveVars(dev, ids, values, batch) != EEPROM_OK) {
+            errors++;
+        }
+    }
+
+    EEPROM_extInit(dev);
+    for (uint8_t id = 0; id < BENCH_VARS; id++) {
+        if (EEPROM_extReadVar(dev, id) != expect[id]) errors++;
+    }
+
+    return errors;
+}
+
+static void report(const char* name, uint8_t batch, EEPROM_ExtDevice* dev,
+                   uint64_t ns, uint32_t wear, uint32_t errors) {
+    printf("%-8s batch %u: %8.0f saves/s %8u writes %9u bytes %5u erases "
+           "max wear %6u %s\n",
+           name, batch, (double)BENCH_SAVES * 1e9 / (double)ns,
+           dev->stats.writes, dev->stats.bytesWritten, dev->stats.erases,
+           wear, errors ? "FAILED" : "ok");
+}
+
+int main(void) {
+    static Sim24cxx eeprom;
+    static SimSpinor nor;
+    EEPROM_I2CBus i2c;
+    EEPROM_SPIBus spi;
+    EEPROM_ExtDevice dev;
+    uint32_t failed = 0;
+    const uint8_t batches[] = {1, BENCH_BATCH};
+
+    for (uint8_t b = 0; b < sizeof(batches); b++) {
+        sim24cxxInit(&eeprom, &i2c, 0x50, 32768, 64);
+        EEPROM_24cxxInit(&dev, &i2c, 0x50, 32768, 64);
+
+        uint32_t errors = runWorkload(&dev, batches[b]);
+        report("24C256", batches[b], &dev, eeprom.clockNs,
+               sim24cxxMaxWear(&eeprom), errors);
+        failed += errors;
+    }
+
+    for (uint8_t b = 0; b < sizeof(batches); b++) {
+        simSpinorInit(&nor, &spi);
+        EEPROM_spinorInit(&dev, &spi, 0, 16384);
+
+        uint32_t errors = runWorkload(&dev, batches[b]);
+        report("SPI NOR", batches[b], &dev, nor.clockNs,
+               simSpinorMaxWear(&nor), errors);
+        failed += errors;
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
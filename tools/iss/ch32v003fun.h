@@ -0,0 +1,61 @@
+/******************************************************************************
+ * ch32v003fun.h - Stand-in for the ISS benchmark (tools/iss_bench.sh)
+ *
+ * The FLASH and SysTick registers are plain RAM and never report busy, and
+ * the storage pages are placed in RAM (EEPROM_ADDRESS), so the library
+ * runs unchanged on a generic RV32 machine. Programming writes the pages
+ * directly; a page erase is emulated from the EEPROM_TRACE_END hook and its
+ * instructions are not charged to the library.
+ ******************************************************************************/
+
+#ifndef ISS_CH32V003FUN_H
+#define ISS_CH32V003FUN_H
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t ACTLR;
+    volatile uint32_t KEYR;
+    volatile uint32_t OBKEYR;
+    volatile uint32_t STATR;
+    volatile uint32_t CTLR;
+    volatile uint32_t ADDR;
+    volatile uint32_t RESERVED;
+    volatile uint32_t OBR;
+    volatile uint32_t WPR;
+    volatile uint32_t MODEKEYR;
+} ISS_FlashRegs;
+
+typedef struct {
+    volatile uint32_t CTLR;
+    volatile uint32_t SR;
+    volatile uint32_t CNT;
+    volatile uint32_t RESERVED0;
+    volatile uint32_t CMP;
+    volatile uint32_t RESERVED1;
+} ISS_SysTickRegs;
+
+extern ISS_FlashRegs iss_flash;
+extern ISS_SysTickRegs iss_systick;
+
+#define FLASH (&iss_flash)
+#define SysTick (&iss_systick)
+
+#define FLASH_CTLR_PG 0x00000001
+#define FLASH_CTLR_PER 0x00000002
+#define FLASH_CTLR_STRT 0x00000040
+#define FLASH_CTLR_LOCK 0x00000080
+#define FLASH_CTLR_FLOCK 0x00008000
+#define FLASH_CTLR_PAGE_PG 0x00010000
+#define FLASH_CTLR_PAGE_ER 0x00020000
+#define FLASH_CTLR_BUF_LOAD 0x00040000
+#define FLASH_CTLR_BUF_RST 0x00080000
+#define FLASH_STATR_BSY 0x00000001
+
+#define DELAY_MS_TIME 6000
+
+// Erase emulation, see iss_bench.c
+void iss_traceEnd(uint8_t op, uint32_t addr);
+#define EEPROM_TRACE_END(op, addr) iss_traceEnd((op), (addr))
+
+#endif /* ISS_CH32V003FUN_H */
@@ -0,0 +1,184 @@
+/******************************************************************************
+ * iss_bench.c - Instruction counts of the library on an RV32 simulator
+ *
+ * Cross-compiled for rv32ec together with src/EEPROM.c and run on QEMU
+ * (see tools/iss_bench.sh). Every API call is measured with the minstret
+ * counter, the instructions spent emulating flash erases are subtracted,
+ * and one "name instructions" line per call is printed on the UART.
+ ******************************************************************************/
+
+#include "EEPROM.h"
+
+#define ISS_UART ((volatile uint8_t*)0x10000000)
+
+// Storage pages below and including EEPROM_ADDRESS, erased at start
+#define ISS_STORE_START \
+    (EEPROM_ADDRESS - (EEPROM_PAGES - 1) * (uint32_t)EEPROM_PAGE_SIZE)
+#define ISS_STORE_END (EEPROM_ADDRESS + EEPROM_PAGE_SIZE)
+
+ISS_FlashRegs iss_flash;
+ISS_SysTickRegs iss_systick;
+
+// Batches of up to 200 saves, cycling through the IDs that fit the store
+#define ISS_BATCH_IDS (EEPROM_CAPACITY < 200 ? EEPROM_CAPACITY : 200)
+
+static uint8_t iss_batchIds[200];
+static uint16_t iss_batchValues[200];
+
+// Instructions retired by the erase emulation
+static uint32_t iss_stub = 0;
+
+static uint32_t iss_instret(void) {
+    uint32_t value;
+
+    __asm__ volatile("csrr %0, minstret" : "=r"(value));
+    return value;
+}
+
+// The compiler may call these for struct copies and initializers
+void* memset(void* dest, int c, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+
+    while (n--) *d++ = (uint8_t)c;
+    return dest;
+}
+
+void* memcpy(void* dest, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+
+    while (n--) *d++ = *s++;
+    return dest;
+}
+
+static void iss_erase(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr < end; addr += 4) {
+        *(volatile uint32_t*)addr = 0xFFFFFFFF;
+    }
+}
+
+// Erase the page the library just started erasing
+void iss_traceEnd(uint8_t op, uint32_t addr) {
+    if (op != EEPROM_TRACE_ERASE) return;
+
+    uint32_t start = iss_instret();
+    iss_erase(addr, addr + EEPROM_PAGE_SIZE);
+    iss_stub += iss_instret() - start;
+}
+
+// Write the decimal digits of a value, returns the end of them
+static char* iss_appendu(char* s, uint32_t value) {
+    char digits[10];
+    uint8_t n = 0;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    while (n) *s++ = digits[--n];
+    return s;
+}
+
+static void iss_puts(const char* s) {
+    while (*s) *ISS_UART = (uint8_t)*s++;
+}
+
+static void iss_putu(uint32_t value) {
+    char digits[11];
+
+    *iss_appendu(digits, value) = 0;
+    iss_puts(digits);
+}
+
+static void iss_report(const char* name, uint32_t instructions) {
+    iss_puts(name);
+    iss_puts(" ");
+    iss_putu(instructions);
+    iss_puts("\n");
+}
+
+// IDs in descending order, so the batch has to be sorted
+static void iss_fillBatch(uint8_t n) {
+    for (uint8_t j = 0; j < n; j++) {
+        iss_batchIds[j] = (uint8_t)((n - 1 - j) % ISS_BATCH_IDS);
+        iss_batchValues[j] = j;
+    }
+}
+
+// "save_batch<n>", with "_ids<k>" when the batch repeats IDs because the
+// store holds fewer than n, so results of different capacities are never
+// compared as the same call
+static const char* iss_batchName(uint8_t n) {
+    static char name[24];
+    char* s = name;
+
+    for (const char* p = "save_batch"; *p; p++) *s++ = *p;
+    s = iss_appendu(s, n);
+
+    if (n > ISS_BATCH_IDS) {
+        for (const char* p = "_ids"; *p; p++) *s++ = *p;
+        s = iss_appendu(s, ISS_BATCH_IDS);
+    }
+
+    *s = 0;
+    return name;
+}
+
+// Run a call and report the instructions it retired
+#define ISS_MEASURE(name, call)                                     \
+    do {                                                            \
+        uint32_t stub = iss_stub;                                   \
+        uint32_t start = iss_instret();                             \
+        call;                                                       \
+        uint32_t spent = iss_instret() - start - (iss_stub - stub); \
+        iss_report(name, spent);                                    \
+    } while (0)
+
+int main(void) {
+    uint8_t ids[4] = {1, 2, 3, 4};
+    uint16_t values[4] = {10, 20, 30, 40};
+    uint16_t history[4];
+    volatile uint16_t sink;
+
+    iss_erase(ISS_STORE_START, ISS_STORE_END);
+    EEPROM_init();
+
+    for (uint8_t id = 0; id < 10; id++) EEPROM_saveVar(id, id);
+
+    // Time to first read after a reset: compare with -DEEPROM_LAZY_MOUNT=1
+    ISS_MEASURE("mount_init", EEPROM_init());
+    ISS_MEASURE("mount_first_read", sink = EEPROM_readVar(5));
+    ISS_MEASURE("save_append", EEPROM_saveVar(5, 500));
+    ISS_MEASURE("save_batch4", EEPROM_saveVars(ids, values, 4));
+    ISS_MEASURE("read_hit", sink = EEPROM_readVar(5));
+    ISS_MEASURE("read_miss", sink = EEPROM_readVar(200));
+    ISS_MEASURE("exists", sink = EEPROM_varExists(9));
+    ISS_MEASURE("read_history4", sink = EEPROM_readHistory(5, history, 4));
+    ISS_MEASURE("delete", EEPROM_deleteVar(9));
+
+    // Fill the page so the next save compacts it
+    for (uint16_t i = 0; i < EEPROM_PAGE_SIZE / EEPROM_RECORD_SIZE; i++) {
+        uint32_t last = EEPROM_ADDRESS + EEPROM_PAGE_SIZE - EEPROM_RECORD_SIZE;
+
+        if (*(volatile uint16_t*)last != 0xFFFF) break;
+        EEPROM_saveVar(0, i);
+    }
+    ISS_MEASURE("save_compact", EEPROM_saveVar(0, 1));
+    ISS_MEASURE("read_after_compact", sink = EEPROM_readVar(5));
+
+    iss_fillBatch(10);
+    ISS_MEASURE(iss_batchName(10),
+                EEPROM_saveVars(iss_batchIds, iss_batchValues, 10));
+    iss_fillBatch(50);
+    ISS_MEASURE(iss_batchName(50),
+                EEPROM_saveVars(iss_batchIds, iss_batchValues, 50));
+    iss_fillBatch(200);
+    ISS_MEASURE(iss_batchName(200),
+                EEPROM_saveVars(iss_batchIds, iss_batchValues, 200));
+
+    ISS_MEASURE("format", EEPROM_format());
+
+    (void)sink;
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Instruction counts and code size of the library for the CH32V003 (RV32EC),
+# measured on QEMU instead of hardware.
+#
+# Usage: tools/iss_bench.sh [baseline]
+#
+# Builds tools/iss/iss_bench.c with src/EEPROM.c for rv32ec, runs it on
+# qemu-system-riscv32 (virt machine, exact instruction counting) and prints
+# the instructions retired by every measured call, then the .text size of
+# every public function. With a baseline file (the saved output of an
+# earlier run), exits with an error when a call got more than 5% slower or a
+# function grew. CC selects the compiler (default riscv-none-elf-gcc), QEMU
+# the simulator and CFLAGS adds configuration, e.g. -DEEPROM_SHARDS=2.
+
+set -e
+
+CC=${CC:-riscv-none-elf-gcc}
+NM=${NM:-${CC%gcc}nm}
+QEMU=${QEMU:-qemu-system-riscv32}
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# The storage pages live in RAM above the benchmark image
+$CC -march=rv32ec_zicsr -mabi=ilp32e -Os -Wall -ffunction-sections \
+    -nostdlib -nostartfiles -DEEPROM_ADDRESS=0x8003FC00 $CFLAGS \
+    -I"$DIR/iss" -I"$DIR/../src" -T "$DIR/iss/bench.ld" \
+    "$DIR/iss/start.S" "$DIR/iss/iss_bench.c" "$DIR/../src/EEPROM.c" \
+    -lgcc -o "$TMP/bench.elf"
+
+{
+    $QEMU -machine virt -bios none -nographic -icount shift=0 \
+        -kernel "$TMP/bench.elf" | tr -d '\r'
+
+    $NM --size-sort -S -t d "$TMP/bench.elf" |
+        awk '$3 ~ /^[Tt]$/ && $4 ~ /^EEPROM_/ {
+            printf "size_%s %d\n", $4, $2
+        }'
+} > "$TMP/result"
+
+cat "$TMP/result"
+
+[ -n "$1" ] || exit 0
+
+# Compare with the baseline: 5% slack for instructions, none for size
+awk 'NR == FNR { base[$1] = $2; next }
+     ($1 in base) {
+         limit = $1 ~ /^size_/ ? base[$1] : base[$1] * 1.05
+         if ($2 > limit) {
+             printf "regression: %s %d -> %d\n", $1, base[$1], $2
+             bad = 1
+         }
+     }
+     END { exit bad }' "$1" "$TMP/result"
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Check the .text cost of EEPROM_reader.h for the CH32V003 against a budget.
+#
+# Usage: tools/reader_size.sh [budget]
+#
+# budget is in bytes (default 640). CC selects the RISC-V compiler
+# (default riscv-none-elf-gcc) and CFLAGS adds layout macros, e.g.
+# CFLAGS="-DEEPROM_SHARDS=2 -DEEPROM_COLD_PAGE=1".
+
+set -e
+
+CC=${CC:-riscv-none-elf-gcc}
+SIZE=${SIZE:-${CC%gcc}size}
+BUDGET=${1:-640}
+SRC=$(dirname "$0")/../src
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# One call site, as in a bootloader
+cat > "$TMP/reader.c" <<'END'
+#include "EEPROM_reader.h"
+
+uint16_t reader_probe(uint16_t key) { return EEPROM_readerRead(key); }
+END
+
+$CC -march=rv32ec_zicsr -mabi=ilp32e -Os -Wall $CFLAGS -I"$SRC" \
+    -c "$TMP/reader.c" -o "$TMP/reader.o"
+
+TEXT=$($SIZE -A "$TMP/reader.o" |
+    awk '$1 ~ /^\.text/ { n += $2 } END { print n + 0 }')
+
+echo "EEPROM_reader.h: $TEXT bytes of .text (budget $BUDGET)"
+[ "$TEXT" -le "$BUDGET" ]
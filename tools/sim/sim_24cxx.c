@@ -0,0 +1,97 @@
+/******************************************************************************
+ * sim_24cxx.c - Host simulator of a 24Cxx I2C EEPROM
+ ******************************************************************************/
+
+#include "sim_24cxx.h"
+
+#include <string.h>
+
+// 9 clocks per byte at 400kHz
+#define SIM_I2C_BYTE_NS 22500
+
+// Start condition and device address; fails while a write cycle runs
+static uint8_t sim24cxxSelect(Sim24cxx* sim, uint8_t addr7) {
+    sim->clockNs += SIM_I2C_BYTE_NS;
+
+    if ((addr7 & 0x78) != (sim->addr7 & 0x78)) return EEPROM_ERROR;
+    if (sim->clockNs < sim->busyUntilNs) return EEPROM_ERROR;
+    return EEPROM_OK;
+}
+
+// Memory address from the address bytes and the device address bits
+static uint32_t sim24cxxAddress(Sim24cxx* sim, uint8_t addr7,
+                                const uint8_t* head, uint8_t headLen) {
+    uint32_t addr = 0;
+
+    for (uint8_t i = 0; i < headLen; i++) addr = (addr << 8) | head[i];
+    if (headLen == 1) addr |= (uint32_t)(addr7 & 0x07) << 8;
+
+    sim->clockNs += (uint64_t)headLen * SIM_I2C_BYTE_NS;
+    return addr % sim->size;
+}
+
+static uint8_t sim24cxxWrite(void* ctx, uint8_t addr7, const uint8_t* head,
+                             uint8_t headLen, const uint8_t* data,
+                             uint16_t len) {
+    Sim24cxx* sim = (Sim24cxx*)ctx;
+
+    if (sim24cxxSelect(sim, addr7) != EEPROM_OK) return EEPROM_ERROR;
+    if (headLen == 0) return EEPROM_OK;  // Address-only poll
+
+    uint32_t addr = sim24cxxAddress(sim, addr7, head, headLen);
+    uint32_t page = addr - addr % sim->pageSize;
+
+    // The address counter wraps inside the page
+    for (uint16_t i = 0; i < len; i++) {
+        sim->mem[page + (addr - page + i) % sim->pageSize] = data[i];
+    }
+
+    sim->clockNs += (uint64_t)len * SIM_I2C_BYTE_NS;
+    if (len > 0) {
+        sim->busyUntilNs = sim->clockNs + sim->writeCycleNs;
+        sim->wear[page / sim->pageSize]++;
+    }
+    return EEPROM_OK;
+}
+
+static uint8_t sim24cxxRead(void* ctx, uint8_t addr7, const uint8_t* head,
+                            uint8_t headLen, uint8_t* data, uint16_t len) {
+    Sim24cxx* sim = (Sim24cxx*)ctx;
+
+    if (sim24cxxSelect(sim, addr7) != EEPROM_OK) return EEPROM_ERROR;
+
+    uint32_t addr = sim24cxxAddress(sim, addr7, head, headLen);
+
+    // Repeated start, then sequential read across the whole array
+    sim->clockNs += SIM_I2C_BYTE_NS;
+    for (uint16_t i = 0; i < len; i++) {
+        data[i] = sim->mem[(addr + i) % sim->size];
+    }
+    sim->clockNs += (uint64_t)len * SIM_I2C_BYTE_NS;
+
+    return EEPROM_OK;
+}
+
+void sim24cxxInit(Sim24cxx* sim, EEPROM_I2CBus* bus, uint8_t addr7,
+                  uint32_t size, uint16_t pageSize) {
+    memset(sim, 0, sizeof(*sim));
+    memset(sim->mem, 0xFF, sizeof(sim->mem));
+    sim->addr7 = addr7;
+    sim->size = size;
+    sim->pageSize = pageSize;
+    sim->writeCycleNs = 5000000;
+
+    bus->write = sim24cxxWrite;
+    bus->read = sim24cxxRead;
+    bus->ctx = sim;
+}
+
+uint32_t sim24cxxMaxWear(const Sim24cxx* sim) {
+    uint32_t max = 0;
+
+    for (uint32_t i = 0; i < sim->size / sim->pageSize; i++) {
+        if (sim->wear[i] > max) max = sim->wear[i];
+    }
+
+    return max;
+}
@@ -0,0 +1,35 @@
+/******************************************************************************
+ * sim_24cxx.h - Host simulator of a 24Cxx I2C EEPROM
+ *
+ * Models page-write wrap-around, the internal write cycle (the device NAKs
+ * its address while busy), per-page wear and bus time at 400kHz.
+ ******************************************************************************/
+
+#ifndef SIM_24CXX_H
+#define SIM_24CXX_H
+
+#include <stdint.h>
+
+#include "EEPROM_ext.h"
+
+#define SIM_24CXX_MAX_SIZE 65536
+
+typedef struct {
+    uint8_t addr7;
+    uint32_t size;
+    uint16_t pageSize;
+    uint32_t writeCycleNs;  // Internal write cycle (tWR)
+    uint64_t clockNs;       // Simulated time
+    uint64_t busyUntilNs;
+    uint8_t mem[SIM_24CXX_MAX_SIZE];
+    uint32_t wear[SIM_24CXX_MAX_SIZE / 8];  // Write cycles per page
+} Sim24cxx;
+
+// Set up an erased (0xFF) device and the bus that talks to it
+void sim24cxxInit(Sim24cxx* sim, EEPROM_I2CBus* bus, uint8_t addr7,
+                  uint32_t size, uint16_t pageSize);
+
+// Highest write cycle count of any page
+uint32_t sim24cxxMaxWear(const Sim24cxx* sim);
+
+#endif /* SIM_24CXX_H */
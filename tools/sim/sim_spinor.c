@@ -0,0 +1,103 @@
+/******************************************************************************
+ * sim_spinor.c - Host simulator of a SPI NOR flash
+ ******************************************************************************/
+
+#include "sim_spinor.h"
+
+#include <string.h>
+
+// 8MHz SPI clock
+#define SIM_SPI_BYTE_NS 1000
+
+// Finish the command when chip select goes high
+static void simSpinorComplete(SimSpinor* sim) {
+    uint8_t busy = sim->clockNs < sim->busyUntilNs;
+
+    if (sim->cmd == 0x06 && !busy) {
+        sim->wel = 1;
+    } else if (sim->cmd == 0x02 && sim->headLen == 4 && sim->wel && !busy) {
+        uint32_t page = sim->addr - sim->addr % SIM_SPINOR_PAGE;
+        uint16_t len = sim->dataLen;
+        if (len > SIM_SPINOR_PAGE) len = SIM_SPINOR_PAGE;
+
+        // Programming clears bits only; the address wraps inside the page
+        for (uint16_t i = 0; i < len; i++) {
+            uint32_t at = page + (sim->addr - page + i) % SIM_SPINOR_PAGE;
+            sim->mem[at] &= sim->page[i];
+        }
+        sim->busyUntilNs = sim->clockNs + sim->programNs;
+        sim->wel = 0;
+    } else if (sim->cmd == 0x20 && sim->headLen == 4 && sim->wel && !busy) {
+        uint32_t sector = sim->addr / SIM_SPINOR_SECTOR;
+
+        memset(sim->mem + sector * SIM_SPINOR_SECTOR, 0xFF,
+               SIM_SPINOR_SECTOR);
+        sim->erases[sector]++;
+        sim->busyUntilNs = sim->clockNs + sim->eraseNs;
+        sim->wel = 0;
+    }
+}
+
+static void simSpinorSelect(void* ctx, uint8_t active) {
+    SimSpinor* sim = (SimSpinor*)ctx;
+
+    if (!active) simSpinorComplete(sim);
+    sim->cmd = 0;
+    sim->headLen = 0;
+    sim->addr = 0;
+    sim->dataLen = 0;
+}
+
+static void simSpinorTransfer(void* ctx, const uint8_t* tx, uint8_t* rx,
+                              uint16_t len) {
+    SimSpinor* sim = (SimSpinor*)ctx;
+
+    for (uint16_t i = 0; i < len; i++) {
+        uint8_t out = tx ? tx[i] : 0xFF;
+        uint8_t in = 0xFF;
+
+        sim->clockNs += SIM_SPI_BYTE_NS;
+
+        if (sim->headLen == 0) {
+            sim->cmd = out;
+            sim->headLen = 1;
+        } else if (sim->cmd == 0x05) {
+            in = sim->clockNs < sim->busyUntilNs ? 0x01 : 0x00;
+            if (sim->wel) in |= 0x02;
+        } else if (sim->headLen < 4 &&
+                   (sim->cmd == 0x03 || sim->cmd == 0x02 ||
+                    sim->cmd == 0x20)) {
+            sim->addr = ((sim->addr << 8) | out) % SIM_SPINOR_SIZE;
+            sim->headLen++;
+        } else if (sim->cmd == 0x03) {
+            in = sim->mem[sim->addr];
+            sim->addr = (sim->addr + 1) % SIM_SPINOR_SIZE;
+        } else if (sim->cmd == 0x02) {
+            sim->page[sim->dataLen % SIM_SPINOR_PAGE] = out;
+            sim->dataLen++;
+        }
+
+        if (rx) rx[i] = in;
+    }
+}
+
+void simSpinorInit(SimSpinor* sim, EEPROM_SPIBus* bus) {
+    memset(sim, 0, sizeof(*sim));
+    memset(sim->mem, 0xFF, sizeof(sim->mem));
+    sim->programNs = 700000;
+    sim->eraseNs = 45000000;
+
+    bus->select = simSpinorSelect;
+    bus->transfer = simSpinorTransfer;
+    bus->ctx = sim;
+}
+
+uint32_t simSpinorMaxWear(const SimSpinor* sim) {
+    uint32_t max = 0;
+
+    for (uint32_t i = 0; i < SIM_SPINOR_SIZE / SIM_SPINOR_SECTOR; i++) {
+        if (sim->erases[i] > max) max = sim->erases[i];
+    }
+
+    return max;
+}
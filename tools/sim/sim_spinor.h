@@ -0,0 +1,44 @@
+/******************************************************************************
+ * sim_spinor.h - Host simulator of a SPI NOR flash
+ *
+ * Models the 25-series READ/WREN/PP/SE/RDSR commands: programming can only
+ * clear bits, page programs wrap inside 256-byte pages, WIP stays set for
+ * the program or erase time and erases are counted per 4KB sector.
+ ******************************************************************************/
+
+#ifndef SIM_SPINOR_H
+#define SIM_SPINOR_H
+
+#include <stdint.h>
+
+#include "EEPROM_ext.h"
+
+#define SIM_SPINOR_SIZE 65536
+#define SIM_SPINOR_PAGE 256
+#define SIM_SPINOR_SECTOR 4096
+
+typedef struct {
+    uint32_t programNs;  // Page program time (tPP)
+    uint32_t eraseNs;    // Sector erase time (tSE)
+    uint64_t clockNs;    // Simulated time
+    uint64_t busyUntilNs;
+    uint8_t wel;  // Write enable latch
+
+    // Command in progress
+    uint8_t cmd;
+    uint8_t headLen;
+    uint32_t addr;
+    uint16_t dataLen;
+    uint8_t page[SIM_SPINOR_PAGE];
+
+    uint8_t mem[SIM_SPINOR_SIZE];
+    uint32_t erases[SIM_SPINOR_SIZE / SIM_SPINOR_SECTOR];
+} SimSpinor;
+
+// Set up an erased device and the bus that talks to it
+void simSpinorInit(SimSpinor* sim, EEPROM_SPIBus* bus);
+
+// Highest erase count of any sector
+uint32_t simSpinorMaxWear(const SimSpinor* sim);
+
+#endif /* SIM_SPINOR_H */
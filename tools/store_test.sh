@@ -0,0 +1,50 @@
+#!/bin/sh
+# Host regression tests of the record store.
+#
+# Usage: tools/store_test.sh
+#
+# Builds tools/test/store_test.c with the library (the external cold tier
+# on the 24Cxx simulator of tools/sim) for the host once per configuration
+# below and runs it; the storage pages are plain memory mapped at their
+# flash addresses. Exits with an error when a build or a check failed. CC
+# selects the compiler (default cc) and CFLAGS adds configuration to every
+# build.
+
+set -e
+
+CC=${CC:-cc}
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+status=0
+
+for config in \
+    "" \
+    "-DEEPROM_SHARDS=3" \
+    "-DEEPROM_HISTORY_KEEP=2" \
+    "-DEEPROM_COLD_PAGE=1" \
+    "-DEEPROM_WRITE_COMBINE=1" \
+    "-DEEPROM_COALESCE_MS=1000" \
+    "-DEEPROM_CRASH_PAGE=1" \
+    "-DEEPROM_LOG_PAGES=3" \
+    "-DEEPROM_ISR_CACHE=16" \
+    "-DEEPROM_COLD_EXTERNAL=1" \
+    "-DEEPROM_LAZY_MOUNT=1 -DEEPROM_SHARDS=2"; do
+    echo "config: ${config:-default}"
+
+    # Flash addresses are 32-bit integers, pointers on the host are not
+    if ! $CC -O2 -Wall -Wextra -Werror -Wno-int-to-pointer-cast \
+        -DEEPROM_BYTES=1 $config $CFLAGS -I"$DIR/test" -I"$DIR/sim" \
+        -I"$DIR/../src" "$DIR/test/store_test.c" "$DIR/../src/EEPROM.c" \
+        "$DIR/../src/EEPROM_bytes.c" "$DIR/../src/EEPROM_ext.c" \
+        "$DIR/../src/EEPROM_24cxx.c" "$DIR/sim/sim_24cxx.c" \
+        -o "$TMP/store_test"; then
+        status=1
+        continue
+    fi
+
+    "$TMP/store_test" || status=1
+done
+
+exit $status
@@ -0,0 +1,743 @@
+/******************************************************************************
+ * store_test.c - Host regression tests of the record store
+ *
+ * Built for the host together with src/EEPROM.c and src/EEPROM_bytes.c
+ * (see tools/store_test.sh), once per configuration. The storage pages are
+ * mapped at their flash addresses and erased at start. Prints one line per
+ * failed check and exits with an error when any check failed.
+ ******************************************************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "EEPROM.h"
+#include "EEPROM_bytes.h"
+#include "EEPROM_reader.h"
+
+#if EEPROM_COLD_EXTERNAL
+#include "sim_24cxx.h"
+#endif
+
+// Every page the configuration uses, from the lowest one up to the store
+#define TEST_PAGES (EEPROM_PAGES + EEPROM_LOG_PAGES + EEPROM_CRASH_PAGE)
+#define TEST_START \
+    ((EEPROM_ADDRESS - (TEST_PAGES - 1) * (uint32_t)EEPROM_PAGE_SIZE) & \
+     ~(uint32_t)0xFFF)
+#define TEST_END (EEPROM_ADDRESS + EEPROM_PAGE_SIZE)
+
+TEST_FlashRegs test_flash;
+TEST_SysTickRegs test_systick;
+
+#if EEPROM_COLD_EXTERNAL
+// The cold tier on a simulated 24C256
+static Sim24cxx test_sim;
+static EEPROM_I2CBus test_i2c;
+static EEPROM_ExtDevice test_cold;
+#endif
+
+static uint32_t test_failures = 0;
+
+#define TEST_CHECK(cond)                                             \
+    do {                                                             \
+        if (!(cond)) {                                               \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);   \
+            test_failures++;                                         \
+        }                                                            \
+    } while (0)
+
+// Erase the page the library just started erasing
+void test_traceEnd(uint8_t op, uint32_t addr) {
+    if (op != EEPROM_TRACE_ERASE) return;
+
+    memset((void*)(uintptr_t)addr, 0xFF, EEPROM_PAGE_SIZE);
+}
+
+static int test_mapStore(void) {
+    void* pages = mmap((void*)(uintptr_t)TEST_START, TEST_END - TEST_START,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+    if (pages == MAP_FAILED) return 0;
+
+    memset(pages, 0xFF, TEST_END - TEST_START);
+    return 1;
+}
+
+// Start from an empty store
+static void test_reset(void) {
+    EEPROM_flushDeferred();
+    EEPROM_format();
+    EEPROM_init();
+}
+
+// Save a key on its own; batches are written through, coalescing or not
+static uint8_t test_save(uint16_t key, uint16_t value) {
+    return EEPROM_saveKeys(&key, &value, 1);
+}
+
+// Save a key until its shard is compacted
+static void test_compact(uint16_t key, uint16_t value) {
+    EEPROM_Stats before;
+    EEPROM_Stats after;
+
+    EEPROM_getStats(&before);
+    do {
+        TEST_CHECK(test_save(key, value) == EEPROM_OK);
+        EEPROM_getStats(&after);
+    } while (after.erases == before.erases);
+}
+
+// Check if the shard of a key holds a record or tombstone of it
+static int test_inShard(uint16_t key) {
+    uint32_t base = EEPROM_SHARD_ADDRESS(EEPROM_SHARD_OF(key));
+
+    for (uint32_t addr = base + EEPROM_HEADER_SIZE;
+         addr + EEPROM_RECORD_SIZE <= base + EEPROM_PAGE_SIZE;
+         addr += EEPROM_RECORD_SIZE) {
+        volatile uint16_t* record = (volatile uint16_t*)(uintptr_t)addr;
+
+        if (record[0] == key &&
+            (record[2] == EEPROM_calcCRC(key, record[1]) ||
+             record[2] == EEPROM_tombstoneCRC(key))) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// A shard takes no more variables than compaction can keep, and stays
+// writable once it is full
+static void test_shardCapacity(void) {
+    uint16_t extra = EEPROM_MAX_VARS * EEPROM_SHARDS;
+
+    test_reset();
+
+    // IDs that are multiples of EEPROM_SHARDS all go to shard 0
+    for (uint16_t i = 0; i < EEPROM_MAX_VARS; i++) {
+        TEST_CHECK(EEPROM_saveKey(i * EEPROM_SHARDS, i) == EEPROM_OK);
+    }
+
+    // An external cold tier takes the variables saved once
+#if EEPROM_COLD_EXTERNAL
+    TEST_CHECK(EEPROM_saveKey(extra, 1) == EEPROM_OK);
+    TEST_CHECK(EEPROM_readKey(0) == 0);
+    TEST_CHECK(EEPROM_deleteKey(extra) == EEPROM_OK);
+#else
+    TEST_CHECK(EEPROM_saveKey(extra, 1) == EEPROM_ERROR);
+    TEST_CHECK(!EEPROM_keyExists(extra));
+#endif
+
+    for (uint16_t n = 0; n < 2000; n++) {
+        uint16_t id = (n % EEPROM_MAX_VARS) * EEPROM_SHARDS;
+
+        TEST_CHECK(EEPROM_saveKey(id, n) == EEPROM_OK);
+        TEST_CHECK(EEPROM_readKey(id) == n);
+    }
+
+    // Deleting a variable frees its place (with a cold tier, the tombstone
+    // stays to hide the cold copy)
+    TEST_CHECK(EEPROM_deleteKey(0) == EEPROM_OK);
+    TEST_CHECK(!EEPROM_keyExists(0));
+#if !EEPROM_COLD_TIER
+    TEST_CHECK(EEPROM_saveKey(extra, 7) == EEPROM_OK);
+    TEST_CHECK(EEPROM_readKey(extra) == 7);
+#endif
+}
+
+// The reserved keys are never saved, found or deleted; EEPROM_KEY_CLEAR
+// would read the generation record
+static void test_reservedKeys(void) {
+    test_reset();
+    TEST_CHECK(EEPROM_clear() == EEPROM_OK);
+
+    for (uint32_t key = EEPROM_KEY_CLEAR; key <= EEPROM_KEY_NONE; key++) {
+        uint16_t history[2];
+
+        TEST_CHECK(EEPROM_saveKey(key, 1) == EEPROM_ERROR);
+        TEST_CHECK(EEPROM_readKey(key) == 0xFFFF);
+        TEST_CHECK(!EEPROM_keyExists(key));
+        TEST_CHECK(EEPROM_readKeyHistory(key, history, 2) == 0);
+        TEST_CHECK(EEPROM_deleteKey(key) == EEPROM_ERROR);
+    }
+
+    TEST_CHECK(EEPROM_saveKey(1, 2) == EEPROM_OK);
+    TEST_CHECK(EEPROM_readKey(1) == 2);
+}
+
+// The virtual EEPROM forgets its cached pages when the store is cleared or
+// formatted, uncommitted writes included
+static void test_bytesReset(void) {
+    test_reset();
+
+    TEST_CHECK(EEPROM_byteWrite(1, 0x12) == EEPROM_OK);
+    TEST_CHECK(EEPROM_bytesCommit() == EEPROM_OK);
+    TEST_CHECK(EEPROM_byteRead(1) == 0x12);
+
+    TEST_CHECK(EEPROM_clear() == EEPROM_OK);
+    TEST_CHECK(EEPROM_byteRead(1) == 0xFF);
+
+    TEST_CHECK(EEPROM_byteWrite(2, 0x34) == EEPROM_OK);
+    TEST_CHECK(EEPROM_bytesCommit() == EEPROM_OK);
+    TEST_CHECK(EEPROM_format() == EEPROM_OK);
+    TEST_CHECK(EEPROM_byteRead(2) == 0xFF);
+
+    TEST_CHECK(EEPROM_byteWrite(3, 0x56) == EEPROM_OK);
+    TEST_CHECK(EEPROM_clear() == EEPROM_OK);
+    TEST_CHECK(EEPROM_byteRead(3) == 0xFF);
+    TEST_CHECK(EEPROM_bytesCommit() == EEPROM_OK);
+    TEST_CHECK(!EEPROM_keyExists(EEPROM_BYTES_KEY + 1));
+}
+
+// Every save is history until compaction keeps EEPROM_HISTORY_KEEP
+// versions, newest first
+static void test_historyDepth(void) {
+    uint16_t key = EEPROM_SHARDS;
+    uint16_t history[16];
+
+    test_reset();
+
+    for (uint16_t n = 0; n < 10; n++) {
+        TEST_CHECK(test_save(key, n) == EEPROM_OK);
+    }
+
+    TEST_CHECK(EEPROM_readKeyHistory(key, history, 4) == 4);
+    TEST_CHECK(history[0] == 9 && history[3] == 6);
+    TEST_CHECK(EEPROM_readKeyHistory(key, history, 16) == 10);
+    TEST_CHECK(history[9] == 0);
+    TEST_CHECK(EEPROM_readKeyHistory(key, history, 0) == 0);
+
+    test_compact(key, 100);
+    TEST_CHECK(EEPROM_readKeyHistory(key, history, 16) ==
+               EEPROM_HISTORY_KEEP);
+    TEST_CHECK(history[0] == 100);
+    TEST_CHECK(EEPROM_readerRead(key) == 100);
+}
+
+// A deleted variable reads as absent right away, and compaction drops it
+// rather than bringing back an older value
+static void test_deleteCompact(void) {
+    uint16_t gone = 0;
+    uint16_t kept = EEPROM_SHARDS;
+    uint16_t history[2];
+
+    test_reset();
+
+    TEST_CHECK(test_save(gone, 1) == EEPROM_OK);
+    TEST_CHECK(test_save(gone, 2) == EEPROM_OK);
+    TEST_CHECK(test_save(kept, 3) == EEPROM_OK);
+
+    TEST_CHECK(EEPROM_deleteKey(gone) == EEPROM_OK);
+    TEST_CHECK(!EEPROM_keyExists(gone));
+    TEST_CHECK(EEPROM_readKey(gone) == 0xFFFF);
+    TEST_CHECK(EEPROM_readKeyHistory(gone, history, 2) == 0);
+    TEST_CHECK(EEPROM_readerRead(gone) == 0xFFFF);
+
+    // Deleting it again finds nothing to hide
+    TEST_CHECK(EEPROM_deleteKey(gone) == EEPROM_OK);
+
+    test_compact(kept, 4);
+    TEST_CHECK(!EEPROM_keyExists(gone));
+    TEST_CHECK(EEPROM_readKeyHistory(gone, history, 2) == 0);
+    TEST_CHECK(EEPROM_readerRead(gone) == 0xFFFF);
+    TEST_CHECK(!test_inShard(gone));
+    TEST_CHECK(EEPROM_readKey(kept) == 4);
+
+    EEPROM_init();
+    TEST_CHECK(!EEPROM_keyExists(gone));
+
+    TEST_CHECK(test_save(gone, 5) == EEPROM_OK);
+    TEST_CHECK(EEPROM_readKey(gone) == 5);
+}
+
+// EEPROM_clear voids every shard at once, and what is saved after it
+// survives a remount and maintenance
+static void test_clearShards(void) {
+    test_reset();
+
+    for (uint16_t key = 0; key < EEPROM_SHARDS; key++) {
+        TEST_CHECK(test_save(key, key + 10) == EEPROM_OK);
+        TEST_CHECK(test_save(key + EEPROM_SHARDS, key + 20) == EEPROM_OK);
+    }
+
+    TEST_CHECK(EEPROM_clear() == EEPROM_OK);
+
+    for (uint16_t key = 0; key < 2 * EEPROM_SHARDS; key++) {
+        TEST_CHECK(!EEPROM_keyExists(key));
+        TEST_CHECK(EEPROM_readKey(key) == 0xFFFF);
+        TEST_CHECK(EEPROM_readerRead(key) == 0xFFFF);
+    }
+
+    uint16_t last = EEPROM_SHARDS - 1;
+
+    TEST_CHECK(test_save(last, 7) == EEPROM_OK);
+    EEPROM_init();
+    TEST_CHECK(EEPROM_readKey(last) == 7);
+    TEST_CHECK(!EEPROM_keyExists(last + EEPROM_SHARDS));
+
+    // Maintenance may move it to the cold tier, which the reader only
+    // sees on the cold page
+    TEST_CHECK(EEPROM_maintain() == EEPROM_OK);
+    EEPROM_init();
+    TEST_CHECK(EEPROM_readKey(last) == 7);
+#if !EEPROM_COLD_EXTERNAL
+    TEST_CHECK(EEPROM_readerRead(last) == 7);
+#endif
+    for (uint16_t key = 0; key < 2 * EEPROM_SHARDS; key++) {
+        if (key != last) TEST_CHECK(!EEPROM_keyExists(key));
+    }
+}
+
+// A lazy mount indexes a shard on its first lookup, so records that reach
+// flash after EEPROM_init are still found; EEPROM_mountStep indexes the
+// rest and then reports that nothing is left
+static void test_lazyMount(void) {
+    uint16_t key = 2 * EEPROM_SHARDS - 1;
+    uint8_t steps = 0;
+
+    test_reset();
+
+    TEST_CHECK(test_save(0, 1) == EEPROM_OK);
+    EEPROM_init();
+
+#if EEPROM_LAZY_MOUNT
+    uint32_t addr = EEPROM_SHARD_ADDRESS(EEPROM_SHARD_OF(key)) +
+                    EEPROM_HEADER_SIZE;
+
+    TEST_CHECK(EEPROM_readKey(0) == 1);
+
+    // Written behind the library's back, before the shard is looked at
+    if (EEPROM_SHARD_OF(key) != 0) {
+        volatile uint16_t* record = (volatile uint16_t*)(uintptr_t)addr;
+
+        record[-2] = EEPROM_MARKER;
+        record[-1] = EEPROM_SUMMARY_NONE;
+        record[0] = key;
+        record[1] = 42;
+        record[2] = EEPROM_calcCRC(key, 42);
+        TEST_CHECK(EEPROM_readKey(key) == 42);
+    }
+#endif
+
+    while (EEPROM_mountStep()) {
+        if (++steps > EEPROM_SHARDS + EEPROM_COLD_TIER) break;
+    }
+    TEST_CHECK(steps <= EEPROM_SHARDS + EEPROM_COLD_TIER);
+    TEST_CHECK(EEPROM_mountStep() == 0);
+    TEST_CHECK(EEPROM_readKey(0) == 1);
+
+    TEST_CHECK(test_save(key, 43) == EEPROM_OK);
+    EEPROM_init();
+    TEST_CHECK(EEPROM_readKey(key) == 43);
+    TEST_CHECK(EEPROM_readKey(0) == 1);
+}
+
+#if EEPROM_COLD_TIER
+// A variable saved less than EEPROM_COLD_THRESHOLD times moves to the cold
+// tier and is still read from there; saving it brings it back, deleting it
+// hides the cold copy
+static void test_coldTier(void) {
+    uint16_t cold = 0;
+    uint16_t hot = EEPROM_SHARDS;
+
+    test_reset();
+
+    // A compaction starts the save counts of the shard again
+    test_compact(hot, 1);
+    TEST_CHECK(test_save(cold, 11) == EEPROM_OK);
+    for (uint16_t n = 0; n < EEPROM_COLD_THRESHOLD; n++) {
+        TEST_CHECK(test_save(hot, 2) == EEPROM_OK);
+    }
+
+    TEST_CHECK(EEPROM_maintain() == EEPROM_OK);
+    TEST_CHECK(!test_inShard(cold));
+    TEST_CHECK(test_inShard(hot));
+    TEST_CHECK(EEPROM_readKey(cold) == 11);
+    TEST_CHECK(EEPROM_readKey(hot) == 2);
+#if EEPROM_COLD_EXTERNAL
+    TEST_CHECK(EEPROM_extReadVar(&test_cold, cold) == 11);
+    TEST_CHECK(!EEPROM_extVarExists(&test_cold, hot));
+#else
+    TEST_CHECK(EEPROM_readerRead(cold) == 11);
+#endif
+
+    // Found again after a remount, through the rebuilt directories
+    EEPROM_init();
+    TEST_CHECK(EEPROM_readKey(cold) == 11);
+
+    TEST_CHECK(test_save(cold, 12) == EEPROM_OK);
+    TEST_CHECK(test_inShard(cold));
+    TEST_CHECK(EEPROM_readKey(cold) == 12);
+
+    TEST_CHECK(EEPROM_deleteKey(cold) == EEPROM_OK);
+    TEST_CHECK(!EEPROM_keyExists(cold));
+    EEPROM_init();
+    TEST_CHECK(!EEPROM_keyExists(cold));
+    TEST_CHECK(EEPROM_readKey(cold) == 0xFFFF);
+}
+#endif
+
+// A record after the hole a torn write left is part of the log, for the
+// library and the reader alike
+static void test_tornEnd(void) {
+    uint32_t addr = EEPROM_SHARD_ADDRESS(0) + EEPROM_HEADER_SIZE;
+    uint16_t key = 3 * EEPROM_SHARDS;
+
+    test_reset();
+
+    // Batches are written through, coalescing or not
+    for (uint16_t id = 0; id < 3 * EEPROM_SHARDS; id += EEPROM_SHARDS) {
+        uint16_t value = id + 1;
+
+        TEST_CHECK(EEPROM_saveKeys(&id, &value, 1) == EEPROM_OK);
+    }
+#if EEPROM_WRITE_COMBINE
+    TEST_CHECK(EEPROM_flushCombined() == EEPROM_OK);
+#endif
+
+    while (*(volatile uint16_t*)addr != 0xFFFF) addr += EEPROM_RECORD_SIZE;
+
+    // The slot at the end stays erased, the record after it made it
+    volatile uint16_t* record =
+        (volatile uint16_t*)(uintptr_t)(addr + EEPROM_RECORD_SIZE);
+    record[0] = key;
+    record[1] = 42;
+    record[2] = EEPROM_calcCRC(key, 42);
+    EEPROM_init();
+
+    TEST_CHECK(EEPROM_readKey(key) == 42);
+    TEST_CHECK(EEPROM_readerRead(key) == 42);
+    TEST_CHECK(EEPROM_readerRead(EEPROM_SHARDS) == EEPROM_SHARDS + 1);
+
+    // The next record goes after it, to erased flash
+    uint16_t id = 0;
+    uint16_t value = 7;
+
+    TEST_CHECK(EEPROM_saveKeys(&id, &value, 1) == EEPROM_OK);
+#if EEPROM_WRITE_COMBINE
+    TEST_CHECK(EEPROM_flushCombined() == EEPROM_OK);
+#endif
+    TEST_CHECK(EEPROM_readKey(0) == 7);
+    TEST_CHECK(EEPROM_readerRead(0) == 7);
+    TEST_CHECK(EEPROM_readerRead(key) == 42);
+}
+
+// An update script with more pairs than one batch takes is rejected, not
+// committed in part
+static void test_updateCount(void) {
+    static uint8_t script[EEPROM_UPDATE_WORDS(EEPROM_UPDATE_MAX + 1) * 2];
+    uint16_t count = EEPROM_UPDATE_MAX + 1;
+    uint16_t words = EEPROM_UPDATE_WORDS(count);
+    uint16_t check = 0;
+
+    test_reset();
+
+    for (uint16_t i = 0; i + 1 < words; i++) {
+        uint16_t word = i == 0 ? count : (uint16_t)(i / 2);
+
+        script[2 * i] = (uint8_t)word;
+        script[2 * i + 1] = (uint8_t)(word >> 8);
+        check ^= word;
+    }
+    script[2 * words - 2] = (uint8_t)check;
+    script[2 * words - 1] = (uint8_t)(check >> 8);
+
+    TEST_CHECK(EEPROM_applyUpdate(script, 2 * words) == EEPROM_ERROR);
+    TEST_CHECK(!EEPROM_keyExists(0));
+}
+
+#if EEPROM_COALESCE_MS
+// A time-budgeted save does exactly what its estimate modeled, even with
+// held saves that are due
+static void test_saveWithinDue(void) {
+    volatile uint16_t* lastFree = (volatile uint16_t*)(uintptr_t)(
+        EEPROM_SHARD_ADDRESS(0) + EEPROM_PAGE_SIZE - 2 * EEPROM_RECORD_SIZE);
+    // Coalescing tracks saves across the tests; the budgeted save is the
+    // first save of its ID, which is always written through
+    uint16_t chatty = 0;
+    uint16_t id = (EEPROM_MAX_VARS + 1) * EEPROM_SHARDS;
+    EEPROM_Cost cost;
+    EEPROM_Stats before;
+    EEPROM_Stats after;
+
+    test_reset();
+
+    // Saves of a chatty variable are held once its interval is known
+    for (uint16_t n = 0; !EEPROM_deferredPending() && n < 8; n++) {
+        test_systick.CNT += DELAY_MS_TIME;
+        TEST_CHECK(EEPROM_saveKey(chatty, n) == EEPROM_OK);
+    }
+    TEST_CHECK(EEPROM_deferredPending() == 1);
+
+    // Leave one record free in shard 0, so committing the held save as
+    // well would compact it
+    while (*lastFree == 0xFFFF) {
+        TEST_CHECK(EEPROM_saveKeys(&id, &id, 1) == EEPROM_OK);
+    }
+
+    test_systick.CNT += (EEPROM_COALESCE_MS + 1) * DELAY_MS_TIME;
+
+    TEST_CHECK(EEPROM_estimateCost(id, 5, &cost) == EEPROM_OK);
+    TEST_CHECK(cost.erases == 0);
+
+    EEPROM_getStats(&before);
+    TEST_CHECK(EEPROM_saveVarWithin(id, 5, cost.us) == EEPROM_OK);
+    EEPROM_getStats(&after);
+
+    TEST_CHECK(after.erases - before.erases == cost.erases);
+    TEST_CHECK(after.programs - before.programs == cost.programs);
+    TEST_CHECK(EEPROM_readKey(id) == 5);
+    TEST_CHECK(EEPROM_deferredPending() == 1);
+    TEST_CHECK(EEPROM_flushDeferred() == EEPROM_OK);
+    TEST_CHECK(!EEPROM_deferredPending());
+}
+#endif
+
+#if EEPROM_WRITE_COMBINE
+// A new key is checked against the shard capacity without programming the
+// staged block
+static void test_combineNewKey(void) {
+    EEPROM_Stats stats;
+    uint32_t blocks;
+
+    test_reset();
+
+    for (uint16_t n = 0; n < 20; n++) {
+        TEST_CHECK(EEPROM_saveKey(0, n) == EEPROM_OK);
+        EEPROM_getStats(&stats);
+        if (stats.unpersisted) break;
+    }
+    TEST_CHECK(stats.unpersisted == 1);
+    blocks = stats.blocks;
+
+    TEST_CHECK(EEPROM_saveKey(EEPROM_SHARDS, 1) == EEPROM_OK);
+    EEPROM_getStats(&stats);
+    TEST_CHECK(stats.blocks == blocks && stats.unpersisted == 2);
+    TEST_CHECK(EEPROM_readKey(EEPROM_SHARDS) == 1);
+
+    // The service call programs the block once it is old enough
+#if EEPROM_COMBINE_MS
+    TEST_CHECK(EEPROM_serviceCombined() == EEPROM_OK);
+    EEPROM_getStats(&stats);
+    TEST_CHECK(stats.blocks == blocks);
+
+    test_systick.CNT += EEPROM_COMBINE_MS * DELAY_MS_TIME;
+    TEST_CHECK(EEPROM_serviceCombined() == EEPROM_OK);
+    EEPROM_getStats(&stats);
+    TEST_CHECK(stats.blocks == blocks + 1 && stats.unpersisted == 0);
+#endif
+    TEST_CHECK(EEPROM_flushCombined() == EEPROM_OK);
+}
+#endif
+
+#if EEPROM_ISR_CACHE
+#define TEST_CACHE_KEY 6
+
+static volatile uint32_t test_cacheReads = 0;
+static volatile uint32_t test_cacheTorn = 0;
+
+// Stands in for an interrupt: a timer signal reads the pair at any point
+// of the main loop, saves included
+static void test_cacheInterrupt(int sig) {
+    uint32_t value = EEPROM_readCached32(TEST_CACHE_KEY);
+
+    (void)sig;
+    if ((value & 0xFFFF) != value >> 16) test_cacheTorn++;
+    test_cacheReads++;
+}
+
+// The seqlock never lets a reader see half of a batch, and the cache
+// follows saves, deletes and formats
+static void test_cacheSeqlock(void) {
+    uint16_t keys[2] = {TEST_CACHE_KEY, TEST_CACHE_KEY + 1};
+    uint16_t values[2] = {0, 0};
+    struct itimerval timer = {{0, 50}, {0, 50}};
+    struct itimerval stop = {{0, 0}, {0, 0}};
+    uint32_t n = 0;
+
+    test_reset();
+
+    TEST_CHECK(EEPROM_saveKeys(keys, values, 2) == EEPROM_OK);
+
+    // Other keys between the halves widen the window a torn read needs
+    TEST_CHECK(EEPROM_cacheKey(keys[0]) == EEPROM_OK);
+    for (uint16_t key = 100; key < 100 + EEPROM_ISR_CACHE - 2; key++) {
+        TEST_CHECK(EEPROM_cacheKey(key) == EEPROM_OK);
+    }
+    TEST_CHECK(EEPROM_cacheKey(keys[1]) == EEPROM_OK);
+    TEST_CHECK(EEPROM_cacheKey(200) == EEPROM_ERROR);
+    TEST_CHECK(EEPROM_readCached32(TEST_CACHE_KEY) == 0);
+    TEST_CHECK(EEPROM_readCached(200) == 0xFFFF);
+
+    signal(SIGALRM, test_cacheInterrupt);
+    setitimer(ITIMER_REAL, &timer, NULL);
+    while (test_cacheReads < 2000 && n < 10000000) {
+        n++;
+        values[0] = (uint16_t)n;
+        values[1] = (uint16_t)n;
+        TEST_CHECK(EEPROM_saveKeys(keys, values, 2) == EEPROM_OK);
+    }
+    setitimer(ITIMER_REAL, &stop, NULL);
+    signal(SIGALRM, SIG_DFL);
+
+    TEST_CHECK(test_cacheReads >= 2000);
+    TEST_CHECK(test_cacheTorn == 0);
+    TEST_CHECK(EEPROM_readCached32(TEST_CACHE_KEY) ==
+               (uint16_t)n * (uint32_t)0x10001);
+
+    TEST_CHECK(EEPROM_deleteKey(keys[1]) == EEPROM_OK);
+    TEST_CHECK(EEPROM_readCached(keys[1]) == 0xFFFF);
+    TEST_CHECK(EEPROM_readCached(keys[0]) == (uint16_t)n);
+
+    TEST_CHECK(EEPROM_format() == EEPROM_OK);
+    TEST_CHECK(EEPROM_readCached(keys[0]) == 0xFFFF);
+}
+#endif
+
+#if EEPROM_CRASH_PAGE
+// Snapshots fill the crash page slot by slot, the newest one is read back,
+// and the page is erased once it has been read
+static void test_crashPage(void) {
+    const uint8_t slots = EEPROM_PAGE_SIZE / EEPROM_CRASH_SLOT;
+    uint32_t words[EEPROM_CRASH_WORDS];
+    uint32_t saved[3] = {0xDEADBEEF, 2, 3};
+
+    // Start from an erased crash page
+    EEPROM_crashRead(words);
+    TEST_CHECK(EEPROM_maintain() == EEPROM_OK);
+    TEST_CHECK(EEPROM_crashRead(words) == 0);
+
+    TEST_CHECK(EEPROM_crashSave(saved, 3) == EEPROM_OK);
+    TEST_CHECK(EEPROM_crashRead(words) == 3);
+    TEST_CHECK(words[0] == 0xDEADBEEF && words[2] == 3);
+
+    for (uint8_t i = 1; i < slots; i++) {
+        saved[0] = i;
+        TEST_CHECK(EEPROM_crashSave(saved, 1) == EEPROM_OK);
+    }
+    TEST_CHECK(EEPROM_crashSave(saved, 1) == EEPROM_ERROR);
+    TEST_CHECK(EEPROM_crashRead(words) == 1);
+    TEST_CHECK(words[0] == slots - 1u);
+
+    TEST_CHECK(EEPROM_maintain() == EEPROM_OK);
+    TEST_CHECK(EEPROM_crashRead(words) == 0);
+    TEST_CHECK(EEPROM_crashSave(saved, 1) == EEPROM_OK);
+}
+#endif
+
+#if EEPROM_LOG_PAGES
+// The log wraps around its ring, a flush pads the last block with 0xFF, and
+// a remount finds the end again
+static void test_logRing(void) {
+    static uint8_t stored[EEPROM_LOG_PAGES * EEPROM_PAGE_SIZE];
+    const uint32_t total = 4 * EEPROM_LOG_PAGES * EEPROM_PAGE_SIZE + 10;
+    EEPROM_LogStats stats;
+    uint32_t length;
+    uint32_t pad = 0;
+
+    TEST_CHECK(EEPROM_logInit(1) == EEPROM_OK);
+    EEPROM_logResetStats();
+    TEST_CHECK(EEPROM_logRead(0, stored, sizeof(stored)) == 0);
+
+    // Bytes never 0xFF, so the padding can be told apart
+    for (uint32_t n = 0; n < total; n++) {
+        uint8_t byte = (uint8_t)(n % 251);
+
+        TEST_CHECK(EEPROM_logWrite(&byte, 1) == EEPROM_OK);
+        TEST_CHECK(EEPROM_logService() == EEPROM_OK);
+    }
+    TEST_CHECK(EEPROM_logFlush() == EEPROM_OK);
+
+    EEPROM_logGetStats(&stats);
+    TEST_CHECK(stats.bytes == total && stats.overruns == 0);
+
+    length = EEPROM_logRead(0, stored, sizeof(stored));
+    while (pad < length && stored[length - pad - 1] == 0xFF) pad++;
+
+    // The ring keeps all but the page erased ahead
+    TEST_CHECK(pad > 0 && pad < EEPROM_LOG_BLOCK);
+    TEST_CHECK(length - pad >
+               (EEPROM_LOG_PAGES - 2) *
+                   (uint32_t)(EEPROM_PAGE_SIZE - EEPROM_LOG_HEADER_SIZE));
+    for (uint32_t i = 0; i < length - pad; i++) {
+        TEST_CHECK(stored[i] == (total - (length - pad) + i) % 251);
+    }
+
+    // After a reset the same bytes are found, and new ones follow the
+    // padding
+    uint8_t byte = 0x42;
+    uint8_t last[2];
+
+    TEST_CHECK(EEPROM_logInit(0) == EEPROM_OK);
+    TEST_CHECK(EEPROM_logRead(0, stored, sizeof(stored)) == length);
+    TEST_CHECK(EEPROM_logWrite(&byte, 1) == EEPROM_OK);
+    TEST_CHECK(EEPROM_logFlush() == EEPROM_OK);
+    TEST_CHECK(EEPROM_logRead(length - 1, last, 2) == 2);
+    TEST_CHECK(last[0] == 0xFF && last[1] == 0x42);
+}
+#endif
+
+// Formatting drops the saves still held in RAM along with the store
+static void test_formatDeferred(void) {
+    test_reset();
+
+    // A save that does not fit its budget is held back
+    TEST_CHECK(EEPROM_saveVarWithin(1, 1234, 0) == EEPROM_DEFERRED);
+    TEST_CHECK(EEPROM_readKey(1) == 1234);
+
+    TEST_CHECK(EEPROM_format() == EEPROM_OK);
+    TEST_CHECK(!EEPROM_deferredPending());
+    TEST_CHECK(!EEPROM_keyExists(1));
+    TEST_CHECK(EEPROM_flushDeferred() == EEPROM_OK);
+    TEST_CHECK(!EEPROM_keyExists(1));
+}
+
+int main(void) {
+    if (!test_mapStore()) {
+        printf("FAIL cannot map the storage pages\n");
+        return 1;
+    }
+
+#if EEPROM_COLD_EXTERNAL
+    sim24cxxInit(&test_sim, &test_i2c, 0x50, 32768, 64);
+    EEPROM_24cxxInit(&test_cold, &test_i2c, 0x50, 32768, 64);
+    EEPROM_setColdDevice(&test_cold);
+#endif
+    EEPROM_init();
+
+    test_shardCapacity();
+    test_reservedKeys();
+    test_bytesReset();
+    test_tornEnd();
+    test_historyDepth();
+    test_deleteCompact();
+    test_clearShards();
+    test_lazyMount();
+#if EEPROM_COLD_TIER
+    test_coldTier();
+#endif
+    test_formatDeferred();
+    test_updateCount();
+#if EEPROM_COALESCE_MS
+    test_saveWithinDue();
+#endif
+#if EEPROM_WRITE_COMBINE
+    test_combineNewKey();
+#endif
+#if EEPROM_CRASH_PAGE
+    test_crashPage();
+#endif
+#if EEPROM_ISR_CACHE
+    test_cacheSeqlock();
+#endif
+#if EEPROM_LOG_PAGES
+    test_logRing();
+#endif
+
+    printf("%s: %lu failed checks\n", test_failures ? "FAIL" : "ok",
+           (unsigned long)test_failures);
+    return test_failures ? 1 : 0;
+}